@@ -0,0 +1,59 @@
+#ifndef ALIGNED_ALLOCATOR_H_INCLUDED
+#define ALIGNED_ALLOCATOR_H_INCLUDED
+
+#include <new>
+#include <cstddef>
+#include <utility>
+
+constexpr std::size_t cache_line_size = 64;
+
+// Widest vector register we pad rows for, in bytes.
+constexpr std::size_t simd_width = 64;
+
+std::size_t round_up(std::size_t value, std::size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// Hands out Alignment-aligned storage and default-initializes elements, so
+// std::vector::resize leaves trivial pixel types uninitialized instead of
+// zeroing them.
+template<typename T, std::size_t Alignment = cache_line_size>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t{Alignment});
+    }
+
+    template<typename U>
+    void construct(U* p) {
+        ::new (static_cast<void*>(p)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template<typename U>
+    bool operator== (const AlignedAllocator<U, Alignment>&) const {
+        return true;
+    }
+};
+
+#endif
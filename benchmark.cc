@@ -0,0 +1,302 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <cstdlib>
+#include <iterator>
+#include <algorithm>
+#include "image.h"
+#include "binary_image.h"
+#include "line_scan.h"
+#include "debug.h"
+
+// Synthetic thresholded plate: foreground everywhere except dark grid lines
+// of the given spacing, skewed by `skew` pixels per pixel, plus a dark dot
+// in every third cell.
+BinaryImage make_plate(int width, int height, int spacing = 45, float skew = 0.02f) {
+    BinaryImage image{width, height};
+    image.loop_2d([&](int i, int j) {
+        float x = i + skew * j + 1000, y = j - skew * i + 1000;
+        float cx = std::fmod(x, spacing), cy = std::fmod(y, spacing);
+        bool line = cx < 3 || cy < 3;
+        float dx = cx - spacing / 2.0f, dy = cy - spacing / 2.0f;
+        int cell = static_cast<int>(x / spacing) * 7 + static_cast<int>(y / spacing);
+        bool dot = dx * dx + dy * dy < 25 && cell % 3 == 0;
+        image.set(i, j, !line && !dot);
+    });
+    return image;
+}
+
+endpoints_t bench_scan(Profiler& profiler, std::string name, const BinaryImage& binary_image, BinaryStorage storage,
+                       int max_overlaps) {
+    endpoints_t x_endpoints, y_endpoints;
+    profiler.profile(name, [&] {
+        find_raw_endpoints(binary_image, max_overlaps, ScanEngine::per_line, storage, x_endpoints, y_endpoints);
+    });
+    x_endpoints.insert(x_endpoints.end(), y_endpoints.begin(), y_endpoints.end());
+    return x_endpoints;
+}
+
+void bench_binary_storage(int width, int height, int max_overlaps = 10) {
+    std::cout << "== binary storage, " << width << "x" << height << " ==\n";
+    BinaryImage binary_image = make_plate(width, height);
+
+    Profiler profiler;
+    profiler.start();
+    auto expected = bench_scan(profiler, "row-major", binary_image, BinaryStorage::row_major, max_overlaps);
+    auto tiled = bench_scan(profiler, "tiled 64x64", binary_image, BinaryStorage::tiled, max_overlaps);
+    auto morton = bench_scan(profiler, "morton 64x64", binary_image, BinaryStorage::morton, max_overlaps);
+    profiler.stop();
+    profiler.print_results();
+
+    if (tiled != expected || morton != expected) {
+        std::cout << "MISMATCH: endpoints differ from row-major\n";
+    }
+}
+
+void bench_skew_bound(int width, int height, int max_overlaps = 10) {
+    std::cout << "== skew bound, " << width << "x" << height << " ==\n";
+    BinaryImage binary_image = make_plate(width, height);
+
+    Profiler profiler;
+    profiler.start();
+    auto scan = [&](std::string name, SkewBound skew) {
+        endpoints_t x_endpoints, y_endpoints;
+        std::pair<int, int> offsets;
+        profiler.profile(name, [&] {
+            offsets = find_raw_endpoints(binary_image, max_overlaps, ScanEngine::per_line, BinaryStorage::row_major,
+                                         x_endpoints, y_endpoints, skew);
+        });
+        std::cout << name << ": max end offset " << offsets.first << " / " << offsets.second << " px\n";
+        x_endpoints.insert(x_endpoints.end(), y_endpoints.begin(), y_endpoints.end());
+        return x_endpoints;
+    };
+    auto expected = scan("unbounded", {});
+    auto automatic = scan("auto", {SkewBound::Kind::automatic});
+    auto degrees = scan("3 degrees", {SkewBound::Kind::degrees, 3.0f});
+    profiler.stop();
+    profiler.print_results();
+
+    if (automatic != expected || degrees != expected) {
+        std::cout << "MISMATCH: bounded endpoints differ from unbounded\n";
+    }
+}
+
+// Per-line draw_line walks against the slope-batched engines, on a plate
+// skewed by plate_skew pixels per pixel, over every slope and within the
+// automatically estimated skew bound.
+void bench_scan_engine(int width, int height, float plate_skew, int max_overlaps = 10) {
+    std::cout << "== scan engine, " << width << "x" << height << ", plate skew " << plate_skew << " ==\n";
+    BinaryImage binary_image = make_plate(width, height, 45, plate_skew);
+
+    Profiler profiler;
+    profiler.start();
+    auto scan = [&](std::string name, ScanEngine engine, SkewBound skew) {
+        endpoints_t x_endpoints, y_endpoints;
+        profiler.profile(name, [&] {
+            find_raw_endpoints(binary_image, max_overlaps, engine, BinaryStorage::row_major, x_endpoints, y_endpoints, skew);
+        });
+        x_endpoints.insert(x_endpoints.end(), y_endpoints.begin(), y_endpoints.end());
+        return x_endpoints;
+    };
+    SkewBound automatic{SkewBound::Kind::automatic};
+    auto expected = scan("per line", ScanEngine::per_line, {});
+    auto tabled = scan("step table", ScanEngine::step_table, {});
+    auto sliced = scan("run sliced", ScanEngine::run_sliced, {});
+    auto batched = scan("bitwise", ScanEngine::slope_batched, {});
+    auto runs = scan("run length", ScanEngine::run_length, {});
+    auto expected_auto = scan("per line, auto skew", ScanEngine::per_line, automatic);
+    auto tabled_auto = scan("step table, auto skew", ScanEngine::step_table, automatic);
+    auto sliced_auto = scan("run sliced, auto skew", ScanEngine::run_sliced, automatic);
+    auto batched_auto = scan("bitwise, auto skew", ScanEngine::slope_batched, automatic);
+    auto runs_auto = scan("run length, auto skew", ScanEngine::run_length, automatic);
+    profiler.stop();
+    profiler.print_results();
+
+    if (tabled != expected || sliced != expected || batched != expected || runs != expected ||
+        tabled_auto != expected_auto || sliced_auto != expected_auto || batched_auto != expected_auto || runs_auto != expected_auto) {
+        std::cout << "MISMATCH: endpoints differ from the per-line engine\n";
+    }
+}
+
+// Coarse-to-fine search against the full-resolution scan, both with the
+// bitwise engine, for grid spacings at both ends of what plates use.
+// Reports lines the pyramid misses; it never reports extra ones.
+void bench_pyramid(int width, int height, int spacing, SkewBound skew, int max_overlaps = 10) {
+    std::cout << "== pyramid, " << width << "x" << height << ", spacing " << spacing
+              << (skew.kind == SkewBound::Kind::automatic ? ", auto skew" : ", unbounded") << " ==\n";
+    BinaryImage binary_image = make_plate(width, height, spacing, 0.02);
+
+    Profiler profiler;
+    profiler.start();
+    auto scan = [&](std::string name, int nr_levels) {
+        endpoints_t x_endpoints, y_endpoints;
+        profiler.profile(name, [&] {
+            find_raw_endpoints(binary_image, max_overlaps, ScanEngine::slope_batched, BinaryStorage::row_major,
+                               x_endpoints, y_endpoints, skew, nr_levels);
+        });
+        x_endpoints.insert(x_endpoints.end(), y_endpoints.begin(), y_endpoints.end());
+        return x_endpoints;
+    };
+    auto expected = scan("full resolution", 0);
+    std::vector<std::pair<int, endpoints_t>> pyramids;
+    for (int nr_levels : {1, 2, 3}) pyramids.emplace_back(nr_levels, scan(std::to_string(nr_levels) + " levels", nr_levels));
+    profiler.stop();
+    profiler.print_results();
+
+    for (auto& [nr_levels, endpoints] : pyramids) {
+        if (endpoints != expected) {
+            std::cout << "MISMATCH: " << nr_levels << " levels found " << endpoints.size() << " of "
+                      << expected.size() << " lines\n";
+        }
+    }
+}
+
+// Every scan engine and storage against a reference that walks both line
+// directions with draw_line on the image itself, so the transposed y pass
+// of find_raw_endpoints is checked too. Random images: random size and fill, overlap limits from 0 to past the
+// 64 and 255 boundaries of the bitwise and run-length engines, and random
+// offset bounds. The pyramid search may miss lines but never invents
+// them, so its lines must be a subset of the full scan's. Returns the
+// number of mismatches.
+int check_scan_engines(int nr_images = 60) {
+    std::cout << "== scan engines, " << nr_images << " random images ==\n";
+    std::mt19937 rng(21);
+    const int overlap_limits[] = {0, 1, 2, 3, 5, 10, 63, 64, 65, 100, 254, 255, 300};
+    struct Variant {
+        std::string name;
+        ScanEngine engine;
+        BinaryStorage storage;
+    };
+    const Variant variants[] = {
+        {"per line", ScanEngine::per_line, BinaryStorage::row_major},
+        {"tiled", ScanEngine::per_line, BinaryStorage::tiled},
+        {"morton", ScanEngine::per_line, BinaryStorage::morton},
+        {"step table", ScanEngine::step_table, BinaryStorage::row_major},
+        {"run sliced", ScanEngine::run_sliced, BinaryStorage::row_major},
+        {"bitwise", ScanEngine::slope_batched, BinaryStorage::row_major},
+        {"run length", ScanEngine::run_length, BinaryStorage::row_major},
+    };
+    int nr_mismatches = 0;
+    for (int n = 0; n < nr_images; ++n) {
+        int width = std::uniform_int_distribution<int>(3, 120)(rng);
+        int height = std::uniform_int_distribution<int>(3, 120)(rng);
+        std::bernoulli_distribution set(std::uniform_real_distribution<double>(0.05, 0.95)(rng));
+        BinaryImage binary_image(width, height);
+        binary_image.loop_2d([&](int i, int j) {
+            if (set(rng)) binary_image.set(i, j);
+        });
+        int max_overlaps = overlap_limits[rng() % std::size(overlap_limits)];
+        int max_offset = rng() % 3 == 0 ? -1 : std::uniform_int_distribution<int>(0, std::max(width, height))(rng);
+        SkewBound skew = max_offset < 0 ? SkewBound{} : SkewBound{SkewBound::Kind::pixels, static_cast<float>(max_offset)};
+
+        auto scan = [&](ScanEngine engine, BinaryStorage storage, int nr_pyramid_levels) {
+            std::pair<endpoints_t, endpoints_t> endpoints;
+            find_raw_endpoints(binary_image, max_overlaps, engine, storage, endpoints.first, endpoints.second, skew,
+                               nr_pyramid_levels);
+            return endpoints;
+        };
+        auto report = [&](const std::string& name) {
+            if (nr_mismatches++ < 5) {
+                std::cout << "MISMATCH: " << name << " on " << width << "x" << height << ", max_overlaps "
+                          << max_overlaps << ", max_offset " << max_offset << '\n';
+            }
+        };
+        std::pair<endpoints_t, endpoints_t> expected;
+        expected.first = find_clear_endpoints(width, [&](int i, int j) {
+            return is_clear_line(binary_image, i, 0, j, height - 1, max_overlaps);
+        }, max_offset);
+        expected.second = find_clear_endpoints(height, [&](int i, int j) {
+            return is_clear_line(binary_image, 0, i, width - 1, j, max_overlaps);
+        }, max_offset);
+        for (auto& variant : variants) {
+            if (scan(variant.engine, variant.storage, 0) != expected) report(variant.name);
+        }
+        for (int nr_levels : {1, 2}) {
+            auto coarse = scan(ScanEngine::slope_batched, BinaryStorage::row_major, nr_levels);
+            if (!std::includes(expected.first.begin(), expected.first.end(), coarse.first.begin(), coarse.first.end()) ||
+                !std::includes(expected.second.begin(), expected.second.end(), coarse.second.begin(), coarse.second.end())) {
+                report(std::to_string(nr_levels) + " pyramid levels");
+            }
+        }
+    }
+    if (nr_mismatches > 0) std::cout << "MISMATCH: " << nr_mismatches << " engine results differ from the reference\n";
+    return nr_mismatches;
+}
+
+// draw_line_columns and draw_line_rows against draw_line on random
+// segments: every octant, axis-aligned and zero-length ones, and ends far
+// outside any image. The runs, expanded back to pixels, must be draw_line's
+// pixels in draw_line's order. Returns the number of mismatches.
+int check_run_rasterizers(int nr_segments = 100000) {
+    std::cout << "== run rasterizers, " << nr_segments << " segments ==\n";
+    std::mt19937 rng(20);
+    std::uniform_int_distribution<int> near(-8, 8), far(-5000, 5000);
+    int nr_mismatches = 0;
+    for (int s = 0; s < nr_segments; ++s) {
+        auto coordinate = [&] { return s % 8 == 3 ? far(rng) : near(rng); };
+        int x0 = coordinate(), y0 = coordinate(), x1 = coordinate(), y1 = coordinate();
+        if (s % 16 == 0) x1 = x0, y1 = y0;
+        else if (s % 16 == 1) x1 = x0;
+        else if (s % 16 == 2) y1 = y0;
+
+        std::vector<std::pair<int, int>> expected, columns, rows;
+        draw_line(x0, y0, x1, y1, [&] (int x, int y) {
+            expected.emplace_back(x, y);
+            return 0;
+        });
+        draw_line_columns(x0, y0, x1, y1, [&] (int x, int y_first, int y_last) {
+            int step = y_first <= y_last ? 1 : -1;
+            for (int y = y_first; y != y_last + step; y += step) columns.emplace_back(x, y);
+            return 0;
+        });
+        draw_line_rows(x0, y0, x1, y1, [&] (int y, int x_first, int x_last) {
+            int step = x_first <= x_last ? 1 : -1;
+            for (int x = x_first; x != x_last + step; x += step) rows.emplace_back(x, y);
+            return 0;
+        });
+        if (columns != expected || rows != expected) {
+            if (nr_mismatches++ < 5) {
+                std::cout << "MISMATCH: (" << x0 << ", " << y0 << ") -> (" << x1 << ", " << y1 << ") differs from draw_line\n";
+            }
+        }
+    }
+    if (nr_mismatches > 0) std::cout << "MISMATCH: " << nr_mismatches << " segments differ from draw_line\n";
+    return nr_mismatches;
+}
+
+// Usage: benchmark [size...]. Each size runs on a size x size plate. Exits
+// with status 1 if any check found a mismatch.
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+int main(int argc, char** argv) {
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        char* end = nullptr;
+        long size = std::strtol(arg.c_str(), &end, 10);
+        if (arg.empty() || *end != '\0' || size < 3 || size > 65536) {
+            bool help = arg == "--help" || arg == "-h";
+            (help ? std::cout : std::cerr) << "usage: benchmark [size...]  (each size >= 3; default 512 1024 2048)\n";
+            return help ? 0 : 1;
+        }
+        sizes.push_back(static_cast<int>(size));
+    }
+    if (sizes.empty()) sizes = {512, 1024, 2048};
+
+    int nr_mismatches = check_run_rasterizers();
+    nr_mismatches += check_scan_engines();
+
+    for (int size : sizes) {
+        bench_binary_storage(size, size);
+        bench_skew_bound(size, size);
+        for (float plate_skew : {0.0f, 0.02f, 0.05f}) {
+            bench_scan_engine(size, size, plate_skew);
+        }
+        for (int spacing : {45, 120}) {
+            bench_pyramid(size, size, spacing, {});
+            bench_pyramid(size, size, spacing, {SkewBound::Kind::automatic});
+        }
+    }
+    return nr_mismatches > 0 ? 1 : 0;
+}
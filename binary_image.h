@@ -0,0 +1,503 @@
+#ifndef BINARY_IMAGE_H_INCLUDED
+#define BINARY_IMAGE_H_INCLUDED
+
+#include <bit>
+#include <array>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include "image.h"
+
+// Even bits of x packed into the low 32 bits.
+constexpr std::uint64_t pack_even_bits(std::uint64_t x) {
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffull;
+    x = (x | (x >> 16)) & 0x00000000ffffffffull;
+    return x;
+}
+
+// 1 bit per pixel, stored row-major in 64-bit words. Bit (i % 64) of word
+// (i / 64) in a row holds pixel i. Bits past the width of a row are always 0,
+// so whole words can be counted without masking.
+class BinaryImage {
+public:
+    using word_t = std::uint64_t;
+    using vector = std::vector<word_t, PoolAllocator<word_t>>;
+    static constexpr int word_bits = 64;
+
+    BinaryImage() = default;
+
+    BinaryImage(int __width, int __height, Initialization __initialization = Initialization::zeroed) :
+        _width(__width), _height(__height), _words_per_row((__width + word_bits - 1) / word_bits) {
+            if (__initialization == Initialization::zeroed) {
+                _data.assign(static_cast<std::size_t>(_words_per_row) * _height, 0);
+            } else {
+                _data.resize(static_cast<std::size_t>(_words_per_row) * _height);
+            }
+    }
+
+    static std::size_t storage_bytes(int __width, int __height) {
+        return static_cast<std::size_t>((__width + word_bits - 1) / word_bits) * __height * sizeof(word_t);
+    }
+
+    int width() const {
+        return _width;
+    }
+
+    int height() const {
+        return _height;
+    }
+
+    int words_per_row() const {
+        return _words_per_row;
+    }
+
+    const vector& data() const {
+        return _data;
+    }
+
+    bool is_valid_index(int i, int j, int padding = 0) const {
+        return i >= padding && j >= padding && i < _width - padding && j < _height - padding;
+    }
+
+    bool operator() (int i, int j) const {
+        return (row(j)[i / word_bits] >> (i % word_bits)) & 1;
+    }
+
+    void set(int i, int j, bool value = true) {
+        word_t mask = word_t{1} << (i % word_bits);
+        word_t& w = row(j)[i / word_bits];
+        w = value ? (w | mask) : (w & ~mask);
+    }
+
+    word_t* row(int j) {
+        return _data.data() + static_cast<std::size_t>(j) * _words_per_row;
+    }
+
+    const word_t* row(int j) const {
+        return _data.data() + static_cast<std::size_t>(j) * _words_per_row;
+    }
+
+    // Word k of row j covers pixels [64k, 64k + 64).
+    word_t word(int k, int j) const {
+        return row(j)[k];
+    }
+
+    void set_word(int k, int j, word_t value) {
+        if (k == _words_per_row - 1) value &= last_word_mask();
+        row(j)[k] = value;
+    }
+
+    int count_row(int j) const {
+        int count = 0;
+        const word_t* r = row(j);
+        for (int k = 0; k < _words_per_row; ++k) {
+            count += std::popcount(r[k]);
+        }
+        return count;
+    }
+
+    int count_column(int i) const {
+        int count = 0;
+        for (int j = 0; j < _height; ++j) {
+            count += (*this)(i, j);
+        }
+        return count;
+    }
+
+    // Lengths of the runs of set pixels in a stretch of a row: the one it
+    // starts with, the one it ends with and the longest. All three equal
+    // the stretch length when every pixel is set.
+    struct Runs {
+        int leading = 0, trailing = 0, longest = 0;
+    };
+
+    // Runs of row j over pixels [i_begin, i_end), one countr_one or
+    // countr_zero per run boundary rather than a step per pixel. Column runs
+    // are the row runs of transposed().
+    Runs row_runs(int j, int i_begin, int i_end) const {
+        Runs runs;
+        bool split = false;
+        int run = 0;
+        const word_t* r = row(j);
+        for (int i = i_begin; i < i_end;) {
+            int offset = i % word_bits;
+            int available = std::min(word_bits - offset, i_end - i);
+            word_t bits = r[i / word_bits] >> offset;
+            i += available;
+            while (true) {
+                int ones = std::min(std::countr_one(bits), available);
+                run += ones;
+                if (ones == available) break;
+                if (!split) runs.leading = run;
+                split = true;
+                runs.longest = std::max(runs.longest, run);
+                run = 0;
+                bits >>= ones;
+                available -= ones;
+                int zeros = std::min(std::countr_zero(bits), available);
+                if (zeros == available) break;
+                bits >>= zeros;
+                available -= zeros;
+            }
+        }
+        if (!split) runs.leading = run;
+        runs.trailing = run;
+        runs.longest = std::max(runs.longest, run);
+        return runs;
+    }
+
+    // Visits only the set bits, so sparse rows cost one step per foreground pixel.
+    std::vector<int> column_counts() const {
+        std::vector<int> counts(_width, 0);
+        for (int j = 0; j < _height; ++j) {
+            const word_t* r = row(j);
+            for (int k = 0; k < _words_per_row; ++k) {
+                for (word_t w = r[k]; w != 0; w &= w - 1) {
+                    ++counts[k * word_bits + std::countr_zero(w)];
+                }
+            }
+        }
+        return counts;
+    }
+
+    std::size_t count() const {
+        std::size_t count = 0;
+        for (auto w : _data) count += std::popcount(w);
+        return count;
+    }
+
+    template<typename Functor>
+    void loop_2d(Functor&& f) const {
+        for (int j = 0; j < _height; ++j) {
+            for (int i = 0; i < _width; ++i) {
+                std::forward<Functor&&>(f)(i, j);
+            }
+        }
+    }
+
+    // Pixel (i, j) of the result is pixel (j, i) of this image. Works in
+    // 64x64-pixel blocks: one word from each of 64 rows in, transposed in
+    // registers, one word to each of 64 rows out. Block rows are independent
+    // and run on the thread pool.
+    BinaryImage transposed() const {
+        BinaryImage output{_height, _width, Initialization::uninitialized};
+        int nr_block_rows = (_height + word_bits - 1) / word_bits;
+        parallel_for(execution::par, 0, nr_block_rows, 1, [&](int begin, int end) {
+            word_t block[word_bits];
+            for (int b = begin; b < end; ++b) {
+                int nr_rows = std::min(word_bits, _height - b * word_bits);
+                for (int k = 0; k < _words_per_row; ++k) {
+                    for (int r = 0; r < word_bits; ++r) block[r] = r < nr_rows ? word(k, b * word_bits + r) : 0;
+                    transpose_block(block);
+                    int nr_columns = std::min(word_bits, _width - k * word_bits);
+                    for (int c = 0; c < nr_columns; ++c) output.row(k * word_bits + c)[b] = block[c];
+                }
+            }
+        });
+        return output;
+    }
+
+    // Half-size image where a pixel is set only if its whole 2x2 block is.
+    // Pixels past the edge count as set.
+    BinaryImage downsampled() const {
+        BinaryImage output{(_width + 1) / 2, (_height + 1) / 2, Initialization::uninitialized};
+        for (int j = 0; j < output._height; ++j) {
+            const word_t* top = row(2 * j);
+            const word_t* bottom = row(std::min(2 * j + 1, _height - 1));
+            for (int k = 0; k < output._words_per_row; ++k) {
+                word_t halves[2] = {0, 0};
+                for (int h = 0; h < 2 && 2 * k + h < _words_per_row; ++h) {
+                    word_t both = padded_word(top, 2 * k + h) & padded_word(bottom, 2 * k + h);
+                    halves[h] = pack_even_bits(both & (both >> 1));
+                }
+                output.set_word(k, j, halves[0] | (halves[1] << 32));
+            }
+        }
+        return output;
+    }
+
+    // Pixels whose whole 3x3 neighbourhood is set. Pixels past the edge
+    // count as set.
+    BinaryImage eroded() const {
+        BinaryImage across{_width, _height, Initialization::uninitialized};
+        for (int j = 0; j < _height; ++j) {
+            const word_t* r = row(j);
+            for (int k = 0; k < _words_per_row; ++k) {
+                word_t w = padded_word(r, k);
+                word_t left = (w << 1) | (padded_word(r, k - 1) >> (word_bits - 1));
+                word_t right = (w >> 1) | (padded_word(r, k + 1) << (word_bits - 1));
+                across.row(j)[k] = w & left & right;
+            }
+        }
+        BinaryImage output{_width, _height, Initialization::uninitialized};
+        for (int j = 0; j < _height; ++j) {
+            for (int k = 0; k < _words_per_row; ++k) {
+                word_t w = across.word(k, j);
+                if (j > 0) w &= across.word(k, j - 1);
+                if (j + 1 < _height) w &= across.word(k, j + 1);
+                output.set_word(k, j, w);
+            }
+        }
+        return output;
+    }
+
+    template<typename T = std::uint8_t>
+    Image<T> to_image() const {
+        Image<T> output{_width, _height, 1};
+        loop_2d([&](int i, int j) {
+            if ((*this)(i, j)) output(i, j) = pixel_traits<T>::max();
+        });
+        return output;
+    }
+
+private:
+    // In-place transpose of a 64x64 bit matrix, bit c of word r being
+    // element (r, c): swaps the off-diagonal 32x32 quadrants, then the
+    // 16x16 ones inside each, and so on down to single bits. Each stage is
+    // independent word pairs, which compilers vectorize.
+    static void transpose_block(word_t (&block)[word_bits]) {
+        word_t mask = 0x00000000ffffffffull;
+        for (int width = word_bits / 2; width > 0; width >>= 1, mask ^= mask << width) {
+            for (int r = 0; r < word_bits; r = ((r | width) + 1) & ~width) {
+                word_t t = ((block[r] >> width) ^ block[r | width]) & mask;
+                block[r] ^= t << width;
+                block[r | width] ^= t;
+            }
+        }
+    }
+
+    // Word k of row r with the bits past the width set, all set outside the row.
+    word_t padded_word(const word_t* r, int k) const {
+        if (k < 0 || k >= _words_per_row) return ~word_t{0};
+        return k == _words_per_row - 1 ? r[k] | ~last_word_mask() : r[k];
+    }
+
+    word_t last_word_mask() const {
+        int r = _width % word_bits;
+        return r == 0 ? ~word_t{0} : (word_t{1} << r) - 1;
+    }
+
+    int _width = 0, _height = 0, _words_per_row = 0;
+    vector _data;
+};
+
+enum class TileOrder {
+    rows,       // word r of a tile is row r of the tile
+    morton      // bits follow a Z-order curve through the tile
+};
+
+// Spreads the low 6 bits of v to the even bit positions 0, 2, ..., 10.
+constexpr std::uint32_t spread_bits_6(std::uint32_t v) {
+    v &= 0x3f;
+    v = (v | (v << 4)) & 0x30f;
+    v = (v | (v << 2)) & 0x333;
+    v = (v | (v << 1)) & 0x555;
+    return v;
+}
+
+constexpr std::uint32_t morton_index(std::uint32_t x, std::uint32_t y) {
+    return spread_bits_6(x) | (spread_bits_6(y) << 1);
+}
+
+// Binary image stored as 64x64-pixel tiles of 64 words (512 bytes) each,
+// tiles in row-major order. A line walk that stays within a 64-pixel wide
+// column band touches one tile per 64 rows instead of one cache line per
+// row, which is what near-vertical draw_line walks do. Read-only; built
+// from a row-major BinaryImage.
+template<TileOrder Order>
+class BlockedBinaryImage {
+public:
+    using word_t = BinaryImage::word_t;
+    static constexpr int tile_size = BinaryImage::word_bits;
+    static constexpr int words_per_tile = tile_size * tile_size / BinaryImage::word_bits;
+
+    BlockedBinaryImage() = default;
+
+    explicit BlockedBinaryImage(const BinaryImage& image) :
+        _width(image.width()), _height(image.height()),
+        _tiles_per_row((image.width() + tile_size - 1) / tile_size) {
+            int tiles_per_column = (_height + tile_size - 1) / tile_size;
+            _data.assign(static_cast<std::size_t>(_tiles_per_row) * tiles_per_column * words_per_tile, 0);
+            for (int j = 0; j < _height; ++j) {
+                const word_t* row = image.row(j);
+                for (int k = 0; k < image.words_per_row(); ++k) {
+                    if constexpr (Order == TileOrder::rows) {
+                        _data[word_index(k * tile_size, j)] = row[k];
+                    } else {
+                        for (word_t w = row[k]; w != 0; w &= w - 1) {
+                            int i = k * tile_size + std::countr_zero(w);
+                            _data[word_index(i, j)] |= word_t{1} << bit_index(i, j);
+                        }
+                    }
+                }
+            }
+    }
+
+    int width() const {
+        return _width;
+    }
+
+    int height() const {
+        return _height;
+    }
+
+    bool is_valid_index(int i, int j, int padding = 0) const {
+        return i >= padding && j >= padding && i < _width - padding && j < _height - padding;
+    }
+
+    bool operator() (int i, int j) const {
+        return (_data[word_index(i, j)] >> bit_index(i, j)) & 1;
+    }
+
+private:
+    std::size_t word_index(int i, int j) const {
+        std::size_t tile = static_cast<std::size_t>(j / tile_size) * _tiles_per_row + i / tile_size;
+        if constexpr (Order == TileOrder::rows) {
+            return tile * words_per_tile + j % tile_size;
+        } else {
+            return tile * words_per_tile + morton_index(i % tile_size, j % tile_size) / BinaryImage::word_bits;
+        }
+    }
+
+    int bit_index(int i, int j) const {
+        if constexpr (Order == TileOrder::rows) {
+            return i % tile_size;
+        } else {
+            return morton_index(i % tile_size, j % tile_size) % BinaryImage::word_bits;
+        }
+    }
+
+    int _width = 0, _height = 0, _tiles_per_row = 0;
+    BinaryImage::vector _data;
+};
+
+using TiledBinaryImage = BlockedBinaryImage<TileOrder::rows>;
+using MortonBinaryImage = BlockedBinaryImage<TileOrder::morton>;
+
+template<typename T>
+BinaryImage apply_thresholding(ImageView<T> image, float threshold) {
+    BinaryImage output{image.width(), image.height(), Initialization::uninitialized};
+    parallel_for(execution::par, 0, image.height(), 0, [&](int row_begin, int row_end) {
+        for (int j = row_begin; j < row_end; ++j) {
+            for (int k = 0; k < output.words_per_row(); ++k) {
+                BinaryImage::word_t w = 0;
+                int begin = k * BinaryImage::word_bits;
+                int end = std::min(begin + BinaryImage::word_bits, image.width());
+                for (int i = begin; i < end; ++i) {
+                    if (convert_pixel<float>(image(i, j)) >= threshold) {
+                        w |= BinaryImage::word_t{1} << (i - begin);
+                    }
+                }
+                output.set_word(k, j, w);
+            }
+        }
+    });
+    return output;
+}
+
+// Rows of a packed 1-bit image, top row first, MSB is the leftmost pixel.
+// Pixels equal to set_value become 1 bits.
+std::vector<unsigned char> pack_binary_rows(const BinaryImage& image, bool set_value) {
+    int bytes_per_row = (image.width() + 7) / 8;
+    std::vector<unsigned char> packed(static_cast<std::size_t>(bytes_per_row) * image.height(), 0);
+    for (int j = 0; j < image.height(); ++j) {
+        unsigned char* out = packed.data() + static_cast<std::size_t>(image.height() - 1 - j) * bytes_per_row;
+        for (int i = 0; i < image.width(); ++i) {
+            if (image(i, j) == set_value) out[i / 8] |= 0x80 >> (i % 8);
+        }
+    }
+    return packed;
+}
+
+std::uint32_t png_crc32(const unsigned char* data, std::size_t size, std::uint32_t crc = 0) {
+    static const auto table = [] {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (std::size_t n = 0; n < size; ++n) crc = table[(crc ^ data[n]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Foreground is written as white to match save_image on the 8-bit form.
+bool write_png_1bit(const BinaryImage& image, const std::string& path) {
+    int bytes_per_row = (image.width() + 7) / 8;
+    auto packed = pack_binary_rows(image, true);
+
+    std::vector<unsigned char> filtered;
+    filtered.reserve(packed.size() + image.height());
+    for (int j = 0; j < image.height(); ++j) {
+        filtered.push_back(0);
+        auto begin = packed.begin() + static_cast<std::size_t>(j) * bytes_per_row;
+        filtered.insert(filtered.end(), begin, begin + bytes_per_row);
+    }
+
+    int zlib_size;
+    unsigned char* zlib = stbi_zlib_compress(filtered.data(), static_cast<int>(filtered.size()), &zlib_size, 8);
+    if (zlib == nullptr) return false;
+
+    std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    auto put_u32 = [&](std::uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) png.push_back((v >> shift) & 0xff);
+    };
+    auto put_chunk = [&](const char* type, const unsigned char* data, std::size_t size) {
+        put_u32(static_cast<std::uint32_t>(size));
+        std::size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data, data + size);
+        put_u32(png_crc32(png.data() + start, size + 4));
+    };
+
+    std::vector<unsigned char> header;
+    for (std::uint32_t v : {static_cast<std::uint32_t>(image.width()), static_cast<std::uint32_t>(image.height())}) {
+        for (int shift = 24; shift >= 0; shift -= 8) header.push_back((v >> shift) & 0xff);
+    }
+    header.insert(header.end(), {1, 0, 0, 0, 0});  // bit depth 1, greyscale
+    put_chunk("IHDR", header.data(), header.size());
+    put_chunk("IDAT", zlib, zlib_size);
+    put_chunk("IEND", nullptr, 0);
+    STBIW_FREE(zlib);
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool ok = std::fwrite(png.data(), 1, png.size(), file) == png.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+bool write_pbm(const BinaryImage& image, const std::string& path) {
+    // In PBM a set bit is black, so foreground pixels are written as 0.
+    auto packed = pack_binary_rows(image, false);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    std::fprintf(file, "P4\n%d %d\n", image.width(), image.height());
+    bool ok = std::fwrite(packed.data(), 1, packed.size(), file) == packed.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+void save_image(const BinaryImage& image, std::string path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    bool written;
+    if (extension == ".png") {
+        written = write_png_1bit(image, path);
+    } else if (extension == ".pbm") {
+        written = write_pbm(image, path);
+    } else {
+        save_image(image.to_image(), path);
+        return;
+    }
+    if (!written) {
+        std::cerr << "Failed to write image at path: " << path << '\n';
+    }
+}
+
+#endif
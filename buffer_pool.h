@@ -0,0 +1,170 @@
+#ifndef BUFFER_POOL_H_INCLUDED
+#define BUFFER_POOL_H_INCLUDED
+
+#include <new>
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <iostream>
+#include "aligned_allocator.h"
+#include "topology.h"
+
+struct BufferPoolStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t bytes_retained = 0;
+    std::size_t peak_bytes_retained = 0;
+};
+
+// Keeps freed pixel buffers around, bucketed by size, so that processing a
+// run of same-sized images reuses the previous image's memory instead of
+// going back to the system allocator. Buffers below min_pooled_bytes are
+// not worth pooling and go straight to operator new.
+class BufferPool {
+public:
+    static constexpr std::size_t min_pooled_bytes = 64 * 1024;
+    static constexpr std::size_t default_capacity = std::size_t{2} << 30;
+
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool() {
+        release();
+    }
+
+    static BufferPool& global() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // Sizes are rounded up to one of 8 classes per power of two, so a
+    // bucket wastes at most 12.5% and nearby sizes share buffers.
+    static std::size_t bucket_size(std::size_t bytes) {
+        std::size_t power = 1;
+        while (power < bytes) power <<= 1;
+        std::size_t granularity = std::max<std::size_t>(power / 8, cache_line_size);
+        return round_up(bytes, granularity);
+    }
+
+    void* allocate(std::size_t bytes) {
+        if (bytes < min_pooled_bytes) return allocate_block(bytes);
+
+        std::size_t bucket = bucket_size(bytes);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _free_blocks.find(bucket);
+            if (it != _free_blocks.end() && !it->second.empty()) {
+                void* p = it->second.back();
+                it->second.pop_back();
+                _stats.bytes_retained -= bucket;
+                ++_stats.hits;
+                return p;
+            }
+            ++_stats.misses;
+        }
+        return allocate_block(bucket);
+    }
+
+    void deallocate(void* p, std::size_t bytes) {
+        if (p == nullptr) return;
+        if (bytes < min_pooled_bytes) {
+            deallocate_block(p);
+            return;
+        }
+
+        std::size_t bucket = bucket_size(bytes);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stats.bytes_retained + bucket <= _capacity) {
+                _free_blocks[bucket].push_back(p);
+                _stats.bytes_retained += bucket;
+                _stats.peak_bytes_retained = std::max(_stats.peak_bytes_retained, _stats.bytes_retained);
+                return;
+            }
+        }
+        deallocate_block(p);
+    }
+
+    // Frees every retained buffer. Buffers still owned by images are unaffected.
+    void release() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& [bucket, blocks] : _free_blocks) {
+            for (void* p : blocks) deallocate_block(p);
+        }
+        _free_blocks.clear();
+        _stats.bytes_retained = 0;
+    }
+
+    // Upper bound on retained bytes; 0 disables pooling.
+    void set_capacity(std::size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _capacity = bytes;
+            if (_stats.bytes_retained <= _capacity) return;
+        }
+        release();
+    }
+
+    BufferPoolStats stats() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+    void print_stats() const {
+        auto s = stats();
+        std::cout << "buffer pool: " << s.hits << " hits, " << s.misses << " misses, "
+                  << s.bytes_retained << " bytes retained (peak " << s.peak_bytes_retained << ")\n";
+    }
+
+private:
+    static void* allocate_block(std::size_t bytes) {
+        void* p = ::operator new(bytes, std::align_val_t{cache_line_size});
+        if (bytes >= min_pooled_bytes && numa_placement() == NumaPlacement::interleave) {
+            interleave_memory(p, bytes);
+        }
+        return p;
+    }
+
+    static void deallocate_block(void* p) {
+        ::operator delete(p, std::align_val_t{cache_line_size});
+    }
+
+    mutable std::mutex _mutex;
+    std::map<std::size_t, std::vector<void*>> _free_blocks;
+    std::size_t _capacity = default_capacity;
+    BufferPoolStats _stats;
+};
+
+// AlignedAllocator that draws from and returns to BufferPool::global().
+// Storage is always cache_line_size aligned.
+template<typename T>
+class PoolAllocator : public AlignedAllocator<T> {
+public:
+    template<typename U>
+    struct rebind {
+        using other = PoolAllocator<U>;
+    };
+
+    PoolAllocator() = default;
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(BufferPool::global().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        BufferPool::global().deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator== (const PoolAllocator<U>&) const {
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+#include "unix_socket.h"
+
+// Sends one request and prints the server's answer. Returns false if the
+// connection broke.
+bool request_image(int fd, SocketReader& reader, const std::string& path, bool send_inline) {
+    std::string request;
+    if (send_inline) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Failed to open image at path: " << path << '\n';
+            return true;
+        }
+        std::string bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        request = "image " + std::to_string(bytes.size()) + "\n" + bytes;
+    } else {
+        request = "path " + std::filesystem::absolute(path).string() + "\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string header;
+    if (!write_all(fd, request) || !reader.read_line(header)) return false;
+
+    std::vector<unsigned char> report;
+    if (header.rfind("ok ", 0) == 0) {
+        if (!reader.read_bytes(report, std::stoull(header.substr(3)))) return false;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "== " << path << " (round trip " << elapsed.count() << "s) ==\n";
+    if (report.empty()) std::cout << header << '\n';
+    else std::cout.write(reinterpret_cast<const char*>(report.data()), report.size());
+    return true;
+}
+
+// Usage:
+//   client <socket path> [--inline] [--repeat <n>] image...
+//   client <socket path> --shutdown
+// Images are sent as paths for the server to open, or with --inline as
+// encoded bytes. --repeat sends the whole list n times over one connection,
+// which shows the warm-server latency after the first round.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: client <socket path> [--inline] [--repeat n] [--shutdown] image...\n";
+        return 1;
+    }
+
+    bool send_inline = false, stop_server = false;
+    int nr_repeats = 1;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--inline") send_inline = true;
+        else if (arg == "--shutdown") stop_server = true;
+        else if (arg == "--repeat" && i + 1 < argc) nr_repeats = std::max(1, std::atoi(argv[++i]));
+        else paths.push_back(arg);
+    }
+
+    int fd = connect_unix(argv[1]);
+    if (fd < 0) return 1;
+    SocketReader reader(fd);
+
+    int status = 0;
+    for (int r = 0; r < nr_repeats && status == 0; ++r) {
+        for (auto& path : paths) {
+            if (!request_image(fd, reader, path, send_inline)) {
+                std::cerr << "Connection to server lost\n";
+                status = 1;
+                break;
+            }
+        }
+    }
+    if (stop_server && status == 0) write_all(fd, "shutdown\n");
+    close(fd);
+    return status;
+}
@@ -72,15 +72,25 @@ public:
         data.emplace_back("other", total_duration - total_duration_profiled);
     }
 
-    void print_results() {
+    // (name, seconds) of every profiled section, in order, plus "other".
+    const std::vector<std::pair<std::string, double>>& results() const {
+        return data;
+    }
+
+    // Wall time between start() and stop().
+    double total() const {
+        return total_duration;
+    }
+
+    void print_results(std::ostream& out = std::cout) {
         std::size_t max_length = 0;
         for (auto p : data) max_length = std::max(max_length, p.first.size());
         for (auto [name, duration] : data) {
-            std::cout << std::left << std::setw(max_length) << name << " "
+            out << std::left << std::setw(max_length) << name << " "
                       << std::fixed << std::setprecision(3) << duration << "s  "
                       << std::right << std::setw(5) << std::setprecision(2) << (duration / total_duration * 100.0) << "%\n";
         }
-        std::cout << "total duration: " << total_duration << "s\n";
+        out << "total duration: " << total_duration << "s\n";
     }
 private:
     std::vector<std::pair<std::string, double>> data;
@@ -8,25 +8,97 @@
 
 #include <filesystem>
 #include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cmath>
 #include <vector>
 #include <string>
 #include <map>
+#include "aligned_allocator.h"
+#include "buffer_pool.h"
+#include "image_view.h"
+#include "thread_pool.h"
 #include "debug.h"
 
 #define pi std::acos(-1)
 
 #define MAX_CHAR 256
 
+template<typename T>
+struct pixel_traits;
+
+template<>
+struct pixel_traits<std::uint8_t> {
+    static constexpr std::uint8_t max() { return 255; }
+};
+
+template<>
+struct pixel_traits<std::uint16_t> {
+    static constexpr std::uint16_t max() { return 65535; }
+};
+
+template<>
+struct pixel_traits<float> {
+    static constexpr float max() { return 1.0f; }
+};
+
+// Maps a pixel value between storage types, keeping [0, max] of one type
+// aligned with [0, max] of the other.
+template<typename U, typename T>
+U convert_pixel(T value) {
+    if constexpr (std::is_same_v<U, T>) {
+        return value;
+    } else if constexpr (std::is_floating_point_v<U>) {
+        return static_cast<U>(value) / pixel_traits<T>::max();
+    } else {
+        float normalized = static_cast<float>(value) / pixel_traits<T>::max();
+        normalized = std::clamp(normalized, 0.0f, 1.0f);
+        return static_cast<U>(std::lround(normalized * pixel_traits<U>::max()));
+    }
+}
+
+// Zeroed buffers are written exactly once on construction. Uninitialized
+// ones are not touched at all and are meant for stages that overwrite
+// every pixel.
+enum class Initialization {
+    zeroed,
+    uninitialized
+};
+
+// Interleaved stores the channels of a pixel next to each other (RGBRGB...),
+// as decoders produce them. Planar stores each channel as its own
+// contiguous plane (RRR...GGG...BBB...).
+enum class Layout {
+    interleaved,
+    planar
+};
+
+template<typename T>
 class Image {
 public:
-    using vector = std::vector<float>;
+    using value_type = T;
+    using vector = std::vector<T, PoolAllocator<T>>;
 
     Image() = default;
 
-    Image(int __width, int __height, int __nr_channels) :
-        _width(__width), _height(__height), _nr_channels(__nr_channels) {
-            _data.resize(_width * _height * _nr_channels);
-            std::fill(_data.begin(), _data.end(), 0);
+    // Storage comes from BufferPool::global() and is cache-line aligned.
+    // With pad_rows every row (of every plane, for planar images) starts on a
+    // simd_width boundary and holds a whole number of vector registers.
+    Image(int __width, int __height, int __nr_channels,
+          Initialization __initialization = Initialization::zeroed, bool __pad_rows = false,
+          Layout __layout = Layout::interleaved) :
+        _width(__width), _height(__height), _nr_channels(__nr_channels), _layout(__layout) {
+            _row_stride = _layout == Layout::planar ? _width : _width * _nr_channels;
+            if (__pad_rows) {
+                _row_stride = static_cast<int>(round_up(_row_stride * sizeof(T), simd_width) / sizeof(T));
+            }
+            _pixel_stride = _layout == Layout::planar ? 1 : _nr_channels;
+            _channel_stride = _layout == Layout::planar ? _row_stride * _height : 1;
+
+            std::size_t size = static_cast<std::size_t>(_row_stride) * _height;
+            if (_layout == Layout::planar) size *= _nr_channels;
+            _data.resize(size);
+            if (__initialization == Initialization::zeroed) zero_fill();
     }
 
     int width() const {
@@ -41,6 +113,29 @@ public:
         return _nr_channels;
     }
 
+    Layout layout() const {
+        return _layout;
+    }
+
+    // Samples between the starts of consecutive rows.
+    int row_stride() const {
+        return _row_stride;
+    }
+
+    // Samples between horizontally adjacent pixels of the same channel.
+    int pixel_stride() const {
+        return _pixel_stride;
+    }
+
+    // Samples between two channels of the same pixel.
+    int channel_stride() const {
+        return _channel_stride;
+    }
+
+    bool is_padded() const {
+        return _row_stride != (_layout == Layout::planar ? _width : _width * _nr_channels);
+    }
+
     const vector& data() const {
         return _data;
     }
@@ -49,11 +144,15 @@ public:
         _width = __width;
         _height = __height;
         _nr_channels = __nr_channels;
+        _layout = Layout::interleaved;
+        _row_stride = __width * __nr_channels;
+        _pixel_stride = __nr_channels;
+        _channel_stride = 1;
         _data = std::forward<vector>(__data);
     }
 
     int get_1d_index(int i, int j, int channel = 0) const {
-        return _nr_channels * ((j * _width) + i) + channel;
+        return j * _row_stride + i * _pixel_stride + channel * _channel_stride;
     }
 
     bool is_valid_index(int i, int j, int padding = 0) const {
@@ -65,22 +164,23 @@ public:
                (i == 0 || j == 0 || (i == _width - 1) || (j == _height - 1));
     }
 
-    float& operator[] (int i) {
+    T& operator[] (int i) {
         return _data[i];
     }
 
-    const float& operator[] (int i) const {
+    const T& operator[] (int i) const {
         return _data[i];
     }
 
-    float& operator() (int i, int j, int channel = 0) {
+    T& operator() (int i, int j, int channel = 0) {
         return _data[get_1d_index(i, j, channel)];
     }
 
-    const float& operator() (int i, int j, int channel = 0) const {
+    const T& operator() (int i, int j, int channel = 0) const {
         return _data[get_1d_index(i, j, channel)];
     }
 
+    // Visits every stored sample, including row padding.
     template<typename Functor>
     void loop_1d(Functor&& f) const {
         for (int i = 0; i < _data.size(); ++i) {
@@ -88,31 +188,183 @@ public:
         }
     }
 
+    // Visits pixels in storage order, so consecutive calls touch
+    // consecutive memory.
     template<typename Functor>
     void loop_2d(Functor&& f) const {
-        for (int i = 0; i < _width; ++i) {
-            for (int j = 0; j < _height; ++j) {
+        for (int j = 0; j < _height; ++j) {
+            for (int i = 0; i < _width; ++i) {
                 std::forward<Functor&&>(f)(i, j);
             }
         }
     }
+
+    // Policy is execution::seq or execution::par. Grain is in samples for
+    // loop_1d and in rows for the 2d and row loops; 0 picks a default.
+    // Parallel loop_2d splits the image into row bands, so f must not
+    // depend on visiting order.
+    template<typename Policy, typename Functor>
+    void loop_1d(const Policy& policy, Functor&& f, int grain = 0) const {
+        parallel_for(policy, 0, static_cast<int>(_data.size()), grain, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) f(i);
+        });
+    }
+
+    template<typename Policy, typename Functor>
+    void loop_2d(const Policy& policy, Functor&& f, int grain = 0) const {
+        parallel_for(policy, 0, _height, grain, [&](int begin, int end) {
+            for (int j = begin; j < end; ++j) {
+                for (int i = 0; i < _width; ++i) f(i, j);
+            }
+        });
+    }
+
+    // Calls f(j, row) once per row, where row points at the first sample
+    // of row j. Sample (i, channel) is at row[i * pixel_stride() +
+    // channel * channel_stride()]; for interleaved images that is simply
+    // width() * nr_channels() consecutive samples.
+    template<typename Functor>
+    void loop_rows(Functor&& f) {
+        for (int j = 0; j < _height; ++j) {
+            std::forward<Functor&&>(f)(j, row(j));
+        }
+    }
+
+    template<typename Functor>
+    void loop_rows(Functor&& f) const {
+        for (int j = 0; j < _height; ++j) {
+            std::forward<Functor&&>(f)(j, row(j));
+        }
+    }
+
+    template<typename Policy, typename Functor>
+    void loop_rows(const Policy& policy, Functor&& f, int grain = 0) {
+        parallel_for(policy, 0, _height, grain, [&](int begin, int end) {
+            for (int j = begin; j < end; ++j) f(j, row(j));
+        });
+    }
+
+    template<typename Policy, typename Functor>
+    void loop_rows(const Policy& policy, Functor&& f, int grain = 0) const {
+        parallel_for(policy, 0, _height, grain, [&](int begin, int end) {
+            for (int j = begin; j < end; ++j) f(j, row(j));
+        });
+    }
+
+    T* row(int j) {
+        return _data.data() + get_1d_index(0, j);
+    }
+
+    const T* row(int j) const {
+        return _data.data() + get_1d_index(0, j);
+    }
+
+    MutableImageView<T> view() {
+        return {_data.data(), _width, _height, _nr_channels, _row_stride, _pixel_stride, _channel_stride};
+    }
+
+    ImageView<T> view() const {
+        return const_view();
+    }
+
+    ImageView<T> const_view() const {
+        return {_data.data(), _width, _height, _nr_channels, _row_stride, _pixel_stride, _channel_stride};
+    }
+
+    operator ImageView<T>() const {
+        return const_view();
+    }
 protected:
     vector& data() {
         return _data;
     }
 
+    // Large buffers are zeroed in parallel row bands to spread the memory
+    // traffic over the pool.
+    void zero_fill() {
+        constexpr std::size_t min_parallel_bytes = std::size_t{1} << 20;
+        if (_data.size() * sizeof(T) < min_parallel_bytes) {
+            std::fill(_data.begin(), _data.end(), T{});
+            return;
+        }
+        int nr_rows = static_cast<int>(_data.size() / _row_stride);
+        parallel_for(execution::par, 0, nr_rows, 0, [&](int begin, int end) {
+            std::fill(_data.begin() + static_cast<std::size_t>(begin) * _row_stride,
+                      _data.begin() + static_cast<std::size_t>(end) * _row_stride, T{});
+        });
+    }
+
 private:
-    int _width, _height, _nr_channels;
+    int _width = 0, _height = 0, _nr_channels = 0;
+    Layout _layout = Layout::interleaved;
+    int _row_stride = 0, _pixel_stride = 0, _channel_stride = 0;
     vector _data;
 
     // Debug debug;
 };
 
-class Kernel : public Image {
+using Image8 = Image<std::uint8_t>;
+using Image16 = Image<std::uint16_t>;
+using Imagef = Image<float>;
+
+// Converts sample type and/or layout; padding is kept as it was.
+template<typename U, typename T>
+Image<U> image_cast(const Image<T>& image, Layout layout) {
+    if constexpr (std::is_same_v<U, T>) {
+        if (layout == image.layout()) return image;
+    }
+
+    Image<U> output{image.width(), image.height(), image.nr_channels(),
+                    Initialization::uninitialized, image.is_padded(), layout};
+    if (layout == image.layout()) {
+        int row_size = image.layout() == Layout::planar ? image.width() : image.width() * image.nr_channels();
+        int nr_planes = image.layout() == Layout::planar ? image.nr_channels() : 1;
+        for (int k = 0; k < nr_planes; ++k) {
+            for (int j = 0; j < image.height(); ++j) {
+                const T* in = image.row(j) + k * image.channel_stride();
+                U* out = output.row(j) + k * output.channel_stride();
+                for (int i = 0; i < row_size; ++i) {
+                    out[i] = convert_pixel<U>(in[i]);
+                }
+            }
+        }
+    } else {
+        // (De)interleaving: walk the destination in storage order, one
+        // channel plane or one interleaved row at a time.
+        for (int k = 0; k < image.nr_channels(); ++k) {
+            for (int j = 0; j < image.height(); ++j) {
+                const T* in = image.row(j) + k * image.channel_stride();
+                U* out = output.row(j) + k * output.channel_stride();
+                for (int i = 0; i < image.width(); ++i) {
+                    out[i * output.pixel_stride()] = convert_pixel<U>(in[i * image.pixel_stride()]);
+                }
+            }
+        }
+    }
+    return output;
+}
+
+template<typename U, typename T>
+Image<U> image_cast(const Image<T>& image) {
+    return image_cast<U>(image, image.layout());
+}
+
+template<typename T>
+Image<T> to_planar(const Image<T>& image) {
+    return image_cast<T>(image, Layout::planar);
+}
+
+template<typename T>
+Image<T> to_interleaved(const Image<T>& image) {
+    return image_cast<T>(image, Layout::interleaved);
+}
+
+template<typename T = float>
+class Kernel : public Image<T> {
 public:
-    Kernel(int __size) : Image(__size, __size, 1), _size(__size) {}
+    Kernel(int __size) : Image<T>(__size, __size, 1), _size(__size) {}
 
-    Kernel& operator= (Image::vector _data) {
+    Kernel& operator= (typename Image<T>::vector _data) {
         this->data() = _data;
         return *this;
     }
@@ -132,33 +384,80 @@ struct vec2 {
     int x, y;
 };
 
-Image load_image(std::string path) {
+namespace detail {
+    // Takes ownership of a buffer returned by stbi_load*. Planar images are
+    // deinterleaved straight out of it.
+    Image8 adopt_decoded(unsigned char* data, int width, int height, int nr_channels, Layout layout) {
+        Image8 image(width, height, nr_channels, Initialization::uninitialized, false, layout);
+        if (layout == Layout::interleaved) {
+            std::copy(data, data + width * height * nr_channels, image.row(0));
+        } else {
+            image.loop_rows(execution::par, [&](int j, std::uint8_t* row) {
+                const unsigned char* in = data + static_cast<std::size_t>(j) * width * nr_channels;
+                for (int k = 0; k < nr_channels; ++k) {
+                    std::uint8_t* out = row + k * image.channel_stride();
+                    for (int i = 0; i < width; ++i) {
+                        out[i] = in[i * nr_channels + k];
+                    }
+                }
+            });
+        }
+
+        // RAII :<
+        stbi_image_free(data);
+        return image;
+    }
+}
+
+Image8 load_image(std::string path, Layout layout = Layout::interleaved) {
     int width, height, nr_channels;
-    stbi_set_flip_vertically_on_load(true);
+    stbi_set_flip_vertically_on_load_thread(true);
     unsigned char* data = stbi_load(path.c_str(), &width, &height, &nr_channels, 0);
 
     if (data == nullptr) {
         std::cerr << "Failed to load image at path: " + path << '\n';
+        return {};
     }
+    return detail::adopt_decoded(data, width, height, nr_channels, layout);
+}
 
-    Image image(width, height, nr_channels);
-    image.loop_1d([&](int i) {
-        image[i] = (float)data[i] / (MAX_CHAR - 1);
-    });
+// Decodes an encoded image (any format stb_image reads) held in memory.
+Image8 load_image_from_memory(const unsigned char* bytes, std::size_t size, Layout layout = Layout::interleaved) {
+    int width, height, nr_channels;
+    stbi_set_flip_vertically_on_load_thread(true);
+    unsigned char* data = stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &nr_channels, 0);
 
-    // RAII :<
-    stbi_image_free(data);
-    return image;
+    if (data == nullptr) {
+        std::cerr << "Failed to decode image: " << stbi_failure_reason() << '\n';
+        return {};
+    }
+    return detail::adopt_decoded(data, width, height, nr_channels, layout);
 }
 
-void save_image(const Image& image, std::string path) {
-    std::vector<unsigned char> data(image.data().size());
-    image.loop_1d([&](int i) {
-        data[i] = static_cast<unsigned char>(image[i] * (MAX_CHAR - 1));
+template<typename T>
+void save_image(const Image<T>& image, std::string path) {
+    int row_size = image.width() * image.nr_channels();
+    std::vector<unsigned char, PoolAllocator<unsigned char>> data(static_cast<std::size_t>(row_size) * image.height());
+    int nr_channels = image.nr_channels(), pixel_stride = image.pixel_stride(), channel_stride = image.channel_stride();
+    image.loop_rows(execution::par, [&](int j, const T* row) {
+        unsigned char* out = data.data() + static_cast<std::size_t>(j) * row_size;
+        if (image.layout() == Layout::interleaved) {
+            for (int i = 0; i < row_size; ++i) {
+                out[i] = convert_pixel<std::uint8_t>(row[i]);
+            }
+            return;
+        }
+        for (int k = 0; k < nr_channels; ++k) {
+            for (int i = 0; i < image.width(); ++i) {
+                out[i * nr_channels + k] = convert_pixel<std::uint8_t>(row[i * pixel_stride + k * channel_stride]);
+            }
+        }
     });
 
     std::string extension = std::filesystem::path(path).extension().string();
-    stbi_flip_vertically_on_write(true);
+    // stb only has a global flag for this; set it once, before any writer
+    // threads read it.
+    [[maybe_unused]] static const bool flip_on_write = (stbi_flip_vertically_on_write(true), true);
     if (extension == ".png") {
         if(!stbi_write_png(path.c_str(), image.width(), image.height(), image.nr_channels(), 
                         data.data(), image.width() * image.nr_channels())) {
@@ -175,33 +474,137 @@ void save_image(const Image& image, std::string path) {
     }
 }
 
-Image convolve_2d(const Image& image, const Kernel& kernel, float normalizing_factor = 1, bool flip_y = true) {
-    Image output{image.width(), image.height(), image.nr_channels()};
+// How convolve_2d reads samples that fall outside the image.
+enum class BorderPolicy {
+    zero,       // treated as 0
+    clamp,      // nearest edge sample: aaa|abcd|ddd
+    mirror,     // reflected without repeating the edge: dcb|abcd|cba
+    wrap        // periodic: bcd|abcd|abc
+};
 
-    output.loop_2d([&](int i, int j) {
-        for (int k = 0; k < output.nr_channels(); ++k) {
-            float kernel_sum = 0;
-            kernel.loop_2d([&](int x, int y) {
-                int n = kernel.size();
-                auto _y = y;
-                if (flip_y) y = n - y - 1;
-                int _i = i + x - n / 2;
-                int _j = j + y - n / 2;
-                if (!output.is_valid_index(_i, _j)) return;
-                kernel_sum += image(_i, _j, k) * kernel(x, _y);
-            });
-            output(i, j, k) = kernel_sum / normalizing_factor;
+// Maps a possibly out-of-range coordinate into [0, size), or -1 when the
+// sample should read as zero.
+int border_index(int i, int size, BorderPolicy policy) {
+    if (i >= 0 && i < size) return i;
+    switch (policy) {
+        case BorderPolicy::zero:
+            return -1;
+        case BorderPolicy::clamp:
+            return std::clamp(i, 0, size - 1);
+        case BorderPolicy::mirror: {
+            if (size == 1) return 0;
+            int period = 2 * (size - 1);
+            i = ((i % period) + period) % period;
+            return i < size ? i : period - i;
         }
-    });
+        case BorderPolicy::wrap:
+            return ((i % size) + size) % size;
+    }
+    return -1;
+}
+
+// Channels are convolved one plane at a time, so on planar images every
+// pass reads and writes a single contiguous plane. Pixels whose whole
+// neighbourhood is inside the image take a branch-free path over row
+// pointers; only the border band goes through border_index.
+template<typename T, typename K>
+void convolve_2d(ImageView<T> image, MutableImageView<T> output, const Kernel<K>& kernel, float normalizing_factor = 1,
+                 bool flip_y = true, BorderPolicy border = BorderPolicy::zero) {
+    int n = kernel.size();
+    int half = n / 2;
+    int width = image.width(), height = image.height();
+
+    // weights[r * n + x] multiplies the sample at offset (x - half, row_offset[r] - half),
+    // with rows in the same order the kernel was summed in before the split.
+    std::vector<float> weights(n * n);
+    std::vector<int> row_offset(n);
+    for (int y = 0; y < n; ++y) {
+        row_offset[y] = flip_y ? n - y - 1 : y;
+        for (int x = 0; x < n; ++x) weights[y * n + x] = kernel(x, y);
+    }
+
+    auto store = [&](T& out, float kernel_sum) {
+        float value = kernel_sum / normalizing_factor;
+        if constexpr (std::is_floating_point_v<T>) {
+            out = value;
+        } else {
+            value = std::clamp(value, 0.0f, static_cast<float>(pixel_traits<T>::max()));
+            out = static_cast<T>(std::lround(value));
+        }
+    };
 
+    int i_begin = std::min(half, width), i_end = std::max(i_begin, width - (n - 1 - half));
+    int j_begin = half, j_end = height - (n - 1 - half);
+
+    for (int k = 0; k < output.nr_channels(); ++k) {
+        auto in = image.channel(k);
+        auto out = output.channel(k);
+        auto pixel_stride = in.pixel_stride();
+
+        auto border_pixel = [&](int i, int j) {
+            float kernel_sum = 0;
+            for (int y = 0; y < n; ++y) {
+                int _j = border_index(j + row_offset[y] - half, height, border);
+                if (_j < 0) continue;
+                for (int x = 0; x < n; ++x) {
+                    int _i = border_index(i + x - half, width, border);
+                    if (_i < 0) continue;
+                    kernel_sum += in(_i, _j) * weights[y * n + x];
+                }
+            }
+            store(out(i, j), kernel_sum);
+        };
+
+        parallel_for(execution::par, 0, height, 0, [&](int row_begin, int row_end) {
+            for (int j = row_begin; j < row_end; ++j) {
+                if (j < j_begin || j >= j_end) {
+                    for (int i = 0; i < width; ++i) border_pixel(i, j);
+                    continue;
+                }
+                for (int i = 0; i < i_begin; ++i) border_pixel(i, j);
+                T* out_row = out.row(j);
+                for (int i = i_begin; i < i_end; ++i) {
+                    float kernel_sum = 0;
+                    for (int y = 0; y < n; ++y) {
+                        const T* in_row = in.row(j + row_offset[y] - half) + (i - half) * pixel_stride;
+                        const float* w = weights.data() + y * n;
+                        for (int x = 0; x < n; ++x) {
+                            kernel_sum += in_row[x * pixel_stride] * w[x];
+                        }
+                    }
+                    store(out_row[i * out.pixel_stride()], kernel_sum);
+                }
+                for (int i = i_end; i < width; ++i) border_pixel(i, j);
+            }
+        });
+    }
+}
+
+template<typename T, typename K>
+Image<T> convolve_2d(ImageView<T> image, const Kernel<K>& kernel, float normalizing_factor = 1,
+                     bool flip_y = true, BorderPolicy border = BorderPolicy::zero) {
+    Layout layout = image.nr_channels() > 1 && image.pixel_stride() == 1 ? Layout::planar : Layout::interleaved;
+    Image<T> output{image.width(), image.height(), image.nr_channels(), Initialization::uninitialized, false, layout};
+    convolve_2d(image, output.view(), kernel, normalizing_factor, flip_y, border);
     return output;
 }
 
-float compute_threshold(const Image& image, int nr_bins = 256) {
+template<typename T>
+float compute_threshold(ImageView<T> image, int nr_bins = 256) {
     float nr_pixels = image.width() * image.height();
     std::vector<int> histogram(nr_bins, 0);
-    image.loop_1d([&](int i) {
-        ++histogram[static_cast<int>(image[i] * (nr_bins - 1))];
+    std::mutex histogram_mutex;
+    parallel_for(execution::par, 0, image.height(), 0, [&](int row_begin, int row_end) {
+        std::vector<int> local_histogram(nr_bins, 0);
+        for (int j = row_begin; j < row_end; ++j) {
+            for (int i = 0; i < image.width(); ++i) {
+                for (int k = 0; k < image.nr_channels(); ++k) {
+                    ++local_histogram[static_cast<int>(convert_pixel<float>(image(i, j, k)) * (nr_bins - 1))];
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(histogram_mutex);
+        for (int b = 0; b < nr_bins; ++b) histogram[b] += local_histogram[b];
     });
 
     std::vector<float> sum_p(nr_bins), sum_pi(nr_bins);
@@ -233,14 +636,6 @@ float compute_threshold(const Image& image, int nr_bins = 256) {
     return threshold;
 }
 
-Image apply_thresholding(const Image& image, float threshold) {
-    Image output{image.width(), image.height(), 1};
-    output.loop_1d([&](int i) {
-        if (image[i] >= threshold) output[i] = 1.0;
-    });
-    return output;
-}
-
 template<typename T>
 std::pair<T, T> solve_linear_equations(T a1, T b1, T c1, T a2, T b2, T c2) {
     T det = a1 * b2 - b1 * a2;
@@ -292,6 +687,82 @@ void draw_line(int x0, int y0,
     }
 }
 
+// draw_line in runs of pixels that share an x: calls f(x, y_first, y_last)
+// for each run in walk order, y_first to y_last inclusive and stepping
+// towards y1. Visits exactly the pixels of draw_line(x0, y0, x1, y1, ...),
+// but finds each run's length with one division instead of a step per
+// pixel, so a steep line costs one call per column. Stops early when f
+// returns non-zero.
+template <typename Functor>
+void draw_line_columns(int x0, int y0,
+                       int x1, int y1,
+                       Functor&& f) {
+
+    auto dx = std::abs(x1 - x0);
+    auto sx = x0 < x1 ? 1 : -1;
+    auto dy = -std::abs(y1 - y0);
+    auto sy = y0 < y1 ? 1 : -1;
+    auto error = dx + dy;
+
+    while (true) {
+        // y-only steps until draw_line's 2 * error >= dy moves x, or the line ends.
+        auto steps = std::abs(y1 - y0);
+        if (2 * error >= dy) steps = 0;
+        else if (dx > 0) steps = std::min(steps, (dy - 2 * error + 2 * dx - 1) / (2 * dx));
+        auto y_last = y0 + sy * steps;
+        if (std::forward<Functor&&>(f)(x0, y0, y_last)) break;
+        error += steps * dx;
+        y0 = y_last;
+
+        if (2 * error < dy) break;
+        if (x0 == x1) break;
+        auto e2 = 2 * error;
+        error += dy;
+        x0 += sx;
+        if (e2 <= dx) {
+            if (y0 == y1) break;
+            error += dx;
+            y0 += sy;
+        }
+    }
+}
+
+// Same as draw_line_columns for runs that share a y: f(y, x_first, x_last).
+// Shallow lines cost one call per row.
+template <typename Functor>
+void draw_line_rows(int x0, int y0,
+                    int x1, int y1,
+                    Functor&& f) {
+
+    auto dx = std::abs(x1 - x0);
+    auto sx = x0 < x1 ? 1 : -1;
+    auto dy = -std::abs(y1 - y0);
+    auto sy = y0 < y1 ? 1 : -1;
+    auto error = dx + dy;
+
+    while (true) {
+        // x-only steps until draw_line's 2 * error <= dx moves y, or the line ends.
+        auto steps = std::abs(x1 - x0);
+        if (2 * error <= dx) steps = 0;
+        else if (dy < 0) steps = std::min(steps, (2 * error - dx - 2 * dy - 1) / (-2 * dy));
+        auto x_last = x0 + sx * steps;
+        if (std::forward<Functor&&>(f)(y0, x0, x_last)) break;
+        error += steps * dy;
+        x0 = x_last;
+
+        if (2 * error > dx) break;
+        if (y0 == y1) break;
+        auto e2 = 2 * error;
+        if (e2 >= dy) {
+            if (x0 == x1) break;
+            error += dy;
+            x0 += sx;
+        }
+        error += dx;
+        y0 += sy;
+    }
+}
+
 using endpoints_t = std::vector<std::pair<int, int>>;
 void sort_endpoints(endpoints_t& endpoints) {
     std::sort(endpoints.begin(), endpoints.end(), [] (const auto& p1, const auto& p2) {
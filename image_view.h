@@ -0,0 +1,110 @@
+#ifndef IMAGE_VIEW_H_INCLUDED
+#define IMAGE_VIEW_H_INCLUDED
+
+#include <cstddef>
+#include <type_traits>
+
+// Non-owning window onto pixel storage. Sample (i, j, c) lives at
+// data + j * row_stride + i * pixel_stride + c * channel_stride, which covers
+// interleaved images, single channels of them and sub-rectangles without a
+// copy. Pixel is const-qualified for read-only views.
+template<typename Pixel>
+class BasicImageView {
+public:
+    using value_type = std::remove_const_t<Pixel>;
+
+    BasicImageView() = default;
+
+    BasicImageView(Pixel* __data, int __width, int __height, int __nr_channels,
+                   std::ptrdiff_t __row_stride, std::ptrdiff_t __pixel_stride, std::ptrdiff_t __channel_stride = 1) :
+        _data(__data), _width(__width), _height(__height), _nr_channels(__nr_channels),
+        _row_stride(__row_stride), _pixel_stride(__pixel_stride), _channel_stride(__channel_stride) {}
+
+    // Mutable views convert to read-only ones.
+    template<typename Other, typename = std::enable_if_t<std::is_same_v<const Other, Pixel> && !std::is_same_v<Other, Pixel>>>
+    BasicImageView(const BasicImageView<Other>& other) :
+        BasicImageView(other.data(), other.width(), other.height(), other.nr_channels(),
+                       other.row_stride(), other.pixel_stride(), other.channel_stride()) {}
+
+    Pixel* data() const {
+        return _data;
+    }
+
+    int width() const {
+        return _width;
+    }
+
+    int height() const {
+        return _height;
+    }
+
+    int nr_channels() const {
+        return _nr_channels;
+    }
+
+    std::ptrdiff_t row_stride() const {
+        return _row_stride;
+    }
+
+    std::ptrdiff_t pixel_stride() const {
+        return _pixel_stride;
+    }
+
+    std::ptrdiff_t channel_stride() const {
+        return _channel_stride;
+    }
+
+    bool empty() const {
+        return _data == nullptr || _width <= 0 || _height <= 0;
+    }
+
+    bool is_valid_index(int i, int j, int padding = 0) const {
+        return i >= padding && j >= padding && i < _width - padding && j < _height - padding;
+    }
+
+    Pixel& operator() (int i, int j, int channel = 0) const {
+        return _data[j * _row_stride + i * _pixel_stride + channel * _channel_stride];
+    }
+
+    Pixel* row(int j) const {
+        return _data + j * _row_stride;
+    }
+
+    BasicImageView sub_view(int x, int y, int __width, int __height) const {
+        return {&(*this)(x, y), __width, __height, _nr_channels, _row_stride, _pixel_stride, _channel_stride};
+    }
+
+    BasicImageView channel(int c) const {
+        return {_data + c * _channel_stride, _width, _height, 1, _row_stride, _pixel_stride, _channel_stride};
+    }
+
+    template<typename Functor>
+    void loop_row_major(Functor&& f) const {
+        for (int j = 0; j < _height; ++j) {
+            for (int i = 0; i < _width; ++i) {
+                std::forward<Functor&&>(f)(i, j);
+            }
+        }
+    }
+
+    // Calls f(j, row) once per row; pixel i of the row is at row[i * pixel_stride()].
+    template<typename Functor>
+    void loop_rows(Functor&& f) const {
+        for (int j = 0; j < _height; ++j) {
+            std::forward<Functor&&>(f)(j, row(j));
+        }
+    }
+
+private:
+    Pixel* _data = nullptr;
+    int _width = 0, _height = 0, _nr_channels = 0;
+    std::ptrdiff_t _row_stride = 0, _pixel_stride = 0, _channel_stride = 0;
+};
+
+template<typename T>
+using ImageView = BasicImageView<const T>;
+
+template<typename T>
+using MutableImageView = BasicImageView<T>;
+
+#endif
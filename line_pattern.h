@@ -0,0 +1,49 @@
+#ifndef LINE_PATTERN_H_INCLUDED
+#define LINE_PATTERN_H_INCLUDED
+
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include "image.h"
+
+// Pixel offsets of the digital line draw_line walks from (0, 0) to
+// (dx, dy), in walk order. draw_line only looks at coordinate differences,
+// so the line from (x0, y0) to (x0 + dx, y0 + dy) is this pattern
+// translated by (x0, y0): one table per slope serves every start point.
+// Kept as two offset arrays so that walking a line is a plain indexed loop
+// without Bresenham's error term and branches.
+struct LinePattern {
+    std::vector<int> x, y;
+
+    LinePattern() = default;
+
+    LinePattern(int dx, int dy) {
+        std::size_t length = std::max(std::abs(dx), std::abs(dy)) + 1;
+        x.reserve(length);
+        y.reserve(length);
+        draw_line(0, 0, dx, dy, [&](int i, int j) {
+            x.push_back(i);
+            y.push_back(j);
+            return 0;
+        });
+    }
+
+    int size() const {
+        return static_cast<int>(x.size());
+    }
+};
+
+// is_clear_line for the line pattern translated to (x0, y0).
+template<typename Binary>
+bool is_clear_line(const Binary& binary_image, int x0, int y0, const LinePattern& pattern, int max_overlaps) {
+    const int* xs = pattern.x.data();
+    const int* ys = pattern.y.data();
+    int curr_overlaps = 0;
+    for (int k = 0, n = pattern.size(); k < n; ++k) {
+        if (!binary_image(x0 + xs[k], y0 + ys[k])) curr_overlaps = 0;
+        else if (++curr_overlaps > max_overlaps) return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef LINE_SCAN_H_INCLUDED
+#define LINE_SCAN_H_INCLUDED
+
+#include <cmath>
+#include <string>
+#include <numbers>
+#include <limits>
+#include <cstdlib>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include "image.h"
+#include "binary_image.h"
+#include "thread_pool.h"
+#include "slope_scan.h"
+
+// Candidate grid lines are rejected as soon as they run through more than
+// max_overlaps consecutive foreground pixels. Binary is any binary image
+// type with operator()(i, j) -> bool.
+template<typename Binary>
+bool is_clear_line(const Binary& binary_image, int x0, int y0, int x1, int y1, int max_overlaps) {
+    bool flag = true;
+    int curr_overlaps = 0;
+    draw_line(x0, y0, x1, y1, [&] (int x, int y) {
+        if (binary_image(x, y)) ++curr_overlaps;
+        else curr_overlaps = 0;
+        if (curr_overlaps > max_overlaps) {
+            flag = false;
+            return -1;
+        }
+        return 0;
+    });
+    return flag;
+}
+
+// Tests every candidate (i, j) with 1 <= i, j < n - 1 and, when max_offset
+// is not negative, |j - i| <= max_offset, on the thread pool, and returns
+// the clear ones in the same (i, j) order as a serial scan.
+// Each start index is one task: lines that hit foreground early are cheap
+// and full-length ones are not, so tasks are handed out dynamically and
+// idle workers steal from busy ones. Every start index collects into its
+// own buffer; the buffers are concatenated at the end.
+template<typename Predicate>
+endpoints_t find_clear_endpoints(int n, Predicate&& is_clear, int max_offset = -1) {
+    std::vector<endpoints_t> per_start(std::max(n, 0));
+    parallel_for(execution::par, 1, n - 1, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            int j_begin = max_offset < 0 ? 1 : std::max(1, i - max_offset);
+            int j_end = max_offset < 0 ? n - 1 : std::min(n - 1, i + max_offset + 1);
+            for (int j = j_begin; j < j_end; ++j) {
+                if (is_clear(i, j)) per_start[i].emplace_back(i, j);
+            }
+        }
+    });
+
+    std::size_t total = 0;
+    for (auto& endpoints : per_start) total += endpoints.size();
+    endpoints_t endpoints;
+    endpoints.reserve(total);
+    for (auto& start : per_start) {
+        endpoints.insert(endpoints.end(), start.begin(), start.end());
+    }
+    return endpoints;
+}
+
+// Largest |j - i| of any clear line found by testing every j for about
+// nr_samples evenly spaced start indices, widened by a margin, or -1 if
+// no sampled start has a clear line. Clear lines only exist along the grid,
+// so this is the plate's skew as an end offset.
+template<typename Predicate>
+int estimate_max_offset(int n, Predicate&& is_clear, int nr_samples = 64) {
+    int nr_starts = n - 2;
+    if (nr_starts <= 0) return -1;
+    nr_samples = std::min(nr_samples, nr_starts);
+    std::vector<int> sample_offsets(nr_samples, -1);
+    parallel_for(execution::par, 0, nr_samples, 1, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            int i = 1 + static_cast<int>(static_cast<long>(s) * nr_starts / nr_samples);
+            for (int j = 1; j < n - 1; ++j) {
+                if (is_clear(i, j)) sample_offsets[s] = std::max(sample_offsets[s], std::abs(j - i));
+            }
+        }
+    });
+    int max_offset = *std::max_element(sample_offsets.begin(), sample_offsets.end());
+    if (max_offset < 0) return -1;
+    return max_offset + std::max(2, max_offset / 4);
+}
+
+// Limit on how far a candidate line's far end may be from its near end,
+// given as an angle from the axis, as a pixel offset, or estimated from
+// the image (see estimate_max_offset).
+struct SkewBound {
+    enum class Kind {
+        unbounded,
+        degrees,
+        pixels,
+        automatic
+    };
+
+    Kind kind = Kind::unbounded;
+    float value = 0.0f;
+
+    // Offset bound for lines running `length` pixels along their axis, or
+    // -1 for none. Automatic bounds are resolved by the caller. Bounds too
+    // large for an int (near-vertical angles, huge pixel counts) exceed any
+    // image and are returned as none rather than overflowing.
+    int max_offset(int length) const {
+        double offset;
+        switch (kind) {
+            case Kind::degrees: offset = std::tan(value * std::numbers::pi_v<double> / 180.0) * length; break;
+            case Kind::pixels: offset = value; break;
+            default: return -1;
+        }
+        offset = std::ceil(offset);
+        if (!(offset < std::numeric_limits<int>::max() / 2)) return -1;
+        return static_cast<int>(offset);
+    }
+};
+
+// Accepts "auto", "<n>px" and "<degrees>" (optionally suffixed "deg"),
+// with n finite and not negative and degrees in [0, 90).
+bool parse_skew_bound(const std::string& text, SkewBound& skew) {
+    if (text == "auto") {
+        skew = {SkewBound::Kind::automatic, 0.0f};
+        return true;
+    }
+    char* end = nullptr;
+    float value = std::strtof(text.c_str(), &end);
+    std::string unit = end;
+    if (end == text.c_str() || !std::isfinite(value) || value < 0) return false;
+    if (unit == "px") skew = {SkewBound::Kind::pixels, value};
+    else if ((unit.empty() || unit == "deg") && value < 90) skew = {SkewBound::Kind::degrees, value};
+    else return false;
+    return true;
+}
+
+// Read once from COUNT_DOTS_MAX_SKEW (same syntax as parse_skew_bound);
+// unbounded if unset or invalid.
+SkewBound skew_bound_from_env() {
+    static SkewBound skew = [] {
+        SkewBound skew;
+        const char* env = std::getenv("COUNT_DOTS_MAX_SKEW");
+        if (env && !parse_skew_bound(env, skew)) {
+            std::cerr << "Invalid COUNT_DOTS_MAX_SKEW: " << env << '\n';
+            skew = {};
+        }
+        return skew;
+    }();
+    return skew;
+}
+
+// Read once from COUNT_DOTS_PYRAMID_LEVELS: how many halvings the
+// coarse-to-fine search starts from (see find_x_endpoints_pyramid). 0, the
+// default, scans at full resolution only.
+int pyramid_levels_from_env() {
+    static int nr_levels = [] {
+        const char* env = std::getenv("COUNT_DOTS_PYRAMID_LEVELS");
+        if (!env) return 0;
+        int value = std::atoi(env);
+        if (value < 0) {
+            std::cerr << "Invalid COUNT_DOTS_PYRAMID_LEVELS: " << env << '\n';
+            return 0;
+        }
+        return value;
+    }();
+    return nr_levels;
+}
+
+// Lines from (i, 0) to (j, height - 1). Lines from (0, i) to (width - 1, j)
+// are these lines of the transposed image.
+template<typename Binary>
+endpoints_t find_x_endpoints(const Binary& binary_image, int max_overlaps, int max_offset = -1) {
+    int width = binary_image.width(), height = binary_image.height();
+    return find_clear_endpoints(width, [&](int i, int j) {
+        return is_clear_line(binary_image, i, 0, j, height - 1, max_overlaps);
+    }, max_offset);
+}
+
+// Adds one run-sliced segment of `length` pixels to a line's current run
+// of set pixels. False once the line has a run longer than max_overlaps.
+bool add_segment_runs(int& curr_overlaps, BinaryImage::Runs runs, int length, int max_overlaps) {
+    if (runs.leading == length) {
+        curr_overlaps += length;
+        return curr_overlaps <= max_overlaps;
+    }
+    if (curr_overlaps + runs.leading > max_overlaps || runs.longest > max_overlaps) return false;
+    curr_overlaps = runs.trailing;
+    return true;
+}
+
+// is_clear_line walked in vertical runs (draw_line_columns), each one a
+// single row_runs query on transposed, the transpose of the binary image.
+// Needs y0 <= y1.
+bool is_clear_line_columns(const BinaryImage& transposed, int x0, int y0, int x1, int y1, int max_overlaps) {
+    bool flag = true;
+    int curr_overlaps = 0;
+    draw_line_columns(x0, y0, x1, y1, [&] (int x, int y_first, int y_last) {
+        flag = add_segment_runs(curr_overlaps, transposed.row_runs(x, y_first, y_last + 1), y_last - y_first + 1, max_overlaps);
+        return flag ? 0 : -1;
+    });
+    return flag;
+}
+
+// find_x_endpoints with run-sliced walks; transposed is the transpose of
+// the binary image. Grid lines are close to their axis, so a line is a
+// handful of long runs.
+endpoints_t find_x_endpoints_sliced(const BinaryImage& binary_image, const BinaryImage& transposed,
+                                    int max_overlaps, int max_offset = -1) {
+    int width = binary_image.width(), height = binary_image.height();
+    return find_clear_endpoints(width, [&](int i, int j) {
+        return is_clear_line_columns(transposed, i, 0, j, height - 1, max_overlaps);
+    }, max_offset);
+}
+
+// End-offset bound actually used for the lines (i, 0) -> (j, height - 1),
+// -1 for none.
+template<typename Binary>
+int resolve_max_offset(const Binary& binary_image, int max_overlaps, const SkewBound& skew) {
+    int width = binary_image.width(), height = binary_image.height();
+    if (skew.kind != SkewBound::Kind::automatic) return skew.max_offset(height - 1);
+    return estimate_max_offset(width, [&](int i, int j) {
+        return is_clear_line(binary_image, i, 0, j, height - 1, max_overlaps);
+    });
+}
+
+// Storage the line scan reads the binary image from.
+enum class BinaryStorage {
+    row_major,
+    tiled,
+    morton
+};
+
+// How the candidate lines are tested.
+enum class ScanEngine {
+    per_line,       // one draw_line walk per candidate, from any BinaryStorage
+    step_table,     // per_line walks over one precomputed LinePattern per slope
+    run_sliced,     // per_line walks in whole runs, one row_runs query per run
+    slope_batched,  // 64 candidates of one slope per word operation, see slope_scan.h
+    run_length      // per-slope run-length maps, one byte per candidate, see slope_scan.h
+};
+
+// Lines (2i + a, 2j + b), a and b in [-2, 3], for every line (i, j) of the
+// level above, kept inside [1, n - 2] and the offset bound; sorted, so the
+// lines found among them come out in find_clear_endpoints order.
+endpoints_t refine_candidates(const endpoints_t& coarse, int n, int max_offset) {
+    endpoints_t candidates;
+    candidates.reserve(coarse.size() * 36);
+    for (auto [i, j] : coarse) {
+        for (int a = -2; a <= 3; ++a) {
+            int fine_i = 2 * i + a;
+            if (fine_i < 1 || fine_i > n - 2) continue;
+            for (int b = -2; b <= 3; ++b) {
+                int fine_j = 2 * j + b;
+                if (fine_j < 1 || fine_j > n - 2) continue;
+                if (max_offset >= 0 && std::abs(fine_j - fine_i) > max_offset) continue;
+                candidates.emplace_back(fine_i, fine_j);
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    return candidates;
+}
+
+// The candidates (i, j) whose line (i, 0) -> (j, height - 1) is clear, in order.
+endpoints_t filter_clear_lines(const BinaryImage& binary_image, const endpoints_t& candidates, int max_overlaps) {
+    int height = binary_image.height();
+    std::vector<char> clear(candidates.size(), 0);
+    parallel_for(execution::par, 0, static_cast<int>(candidates.size()), 256, [&](int begin, int end) {
+        for (int c = begin; c < end; ++c) {
+            auto [i, j] = candidates[c];
+            clear[c] = is_clear_line(binary_image, i, 0, j, height - 1, max_overlaps);
+        }
+    });
+    endpoints_t endpoints;
+    for (std::size_t c = 0; c < candidates.size(); ++c) {
+        if (clear[c]) endpoints.push_back(candidates[c]);
+    }
+    return endpoints;
+}
+
+// Coarse-to-fine find_x_endpoints. Level l halves level l - 1 (a pixel is
+// set only if its whole 2x2 block is) and is eroded by one pixel before
+// scanning, so a clear line stays clear at every level even where the
+// coarse line runs a pixel beside it; max_overlaps scales down with the
+// level, plus one for rounding. coarse_scan(level, level_transposed,
+// max_overlaps, max_offset) tests every candidate of the coarsest level; each finer
+// level only tests the neighbourhoods of the lines found one level up, and
+// level 0 applies the exact rule to the binary image itself. Every line
+// returned is clear, but unlike the full scan this is a heuristic: a clear
+// line whose coarse versions all fail is missed. Levels stop before either
+// side drops under 32 pixels.
+template<typename CoarseScan>
+endpoints_t find_x_endpoints_pyramid(const BinaryImage& binary_image, const BinaryImage& transposed, int max_overlaps,
+                                     int max_offset, int nr_levels, CoarseScan&& coarse_scan) {
+    std::vector<BinaryImage> levels;
+    const BinaryImage* level = &binary_image;
+    while (static_cast<int>(levels.size()) < nr_levels && level->width() >= 64 && level->height() >= 64) {
+        levels.push_back(level->downsampled());
+        level = &levels.back();
+    }
+    if (levels.empty()) return coarse_scan(binary_image, transposed, max_overlaps, max_offset);
+
+    auto level_overlaps = [&](int l) {
+        int scale = 1 << l;
+        return (max_overlaps + scale - 1) / scale + 1;
+    };
+    auto level_offset = [&](int l) {
+        return max_offset < 0 ? -1 : (max_offset >> l) + 2;
+    };
+    int top = static_cast<int>(levels.size());
+    BinaryImage coarse = levels.back().eroded();
+    endpoints_t endpoints = coarse_scan(coarse, coarse.transposed(), level_overlaps(top), level_offset(top));
+    for (int l = top - 1; l >= 0; --l) {
+        const BinaryImage& image = l == 0 ? binary_image : levels[l - 1].eroded();
+        endpoints_t candidates = refine_candidates(endpoints, image.width(), l == 0 ? max_offset : level_offset(l));
+        endpoints = filter_clear_lines(image, candidates, l == 0 ? max_overlaps : level_overlaps(l));
+    }
+    return endpoints;
+}
+
+template<typename Scan>
+endpoints_t scan_storage(const BinaryImage& binary_image, BinaryStorage storage, Scan&& scan) {
+    switch (storage) {
+        case BinaryStorage::tiled: return scan(TiledBinaryImage(binary_image));
+        case BinaryStorage::morton: return scan(MortonBinaryImage(binary_image));
+        default: return scan(binary_image);
+    }
+}
+
+// find_x_endpoints with the given engine; transposed is the transpose of
+// binary_image. storage only applies to the per-line engines.
+endpoints_t find_x_endpoints_with(ScanEngine engine, BinaryStorage storage, const BinaryImage& binary_image,
+                                  const BinaryImage& transposed, int max_overlaps, int max_offset = -1) {
+    switch (engine) {
+        case ScanEngine::per_line:
+            return scan_storage(binary_image, storage, [&](const auto& stored) {
+                return find_x_endpoints(stored, max_overlaps, max_offset);
+            });
+        case ScanEngine::step_table:
+            return scan_storage(binary_image, storage, [&](const auto& stored) {
+                return find_x_endpoints_tabled(stored, max_overlaps, max_offset);
+            });
+        case ScanEngine::run_sliced:
+            return find_x_endpoints_sliced(binary_image, transposed, max_overlaps, max_offset);
+        case ScanEngine::slope_batched:
+            return find_x_endpoints_batched(binary_image, max_overlaps, max_offset);
+        case ScanEngine::run_length:
+            return find_x_endpoints_runs(binary_image, max_overlaps, max_offset);
+    }
+    return {};
+}
+
+// Clear lines (i, 0) -> (j, height - 1) and (0, i) -> (width - 1, j).
+// draw_line treats both axes alike, so the second kind are, pixel for
+// pixel, the first kind of the transposed image: the binary image is
+// transposed once and every engine runs its vertical pass on both, each
+// walking along its own storage's fast axis. With nr_pyramid_levels > 0
+// the engine only scans the coarsest level of find_x_endpoints_pyramid.
+// Returns the end-offset bounds used for the x and y lines, -1 for none.
+std::pair<int, int> find_raw_endpoints(const BinaryImage& binary_image, int max_overlaps, ScanEngine engine,
+                                       BinaryStorage storage, endpoints_t& x_endpoints, endpoints_t& y_endpoints,
+                                       const SkewBound& skew = {}, int nr_pyramid_levels = 0) {
+    BinaryImage transposed = binary_image.transposed();
+    auto scan = [&](const BinaryImage& image, const BinaryImage& image_transposed, endpoints_t& endpoints) {
+        int max_offset = resolve_max_offset(image, max_overlaps, skew);
+        if (nr_pyramid_levels > 0) {
+            endpoints = find_x_endpoints_pyramid(image, image_transposed, max_overlaps, max_offset, nr_pyramid_levels,
+                [&](const BinaryImage& level, const BinaryImage& level_transposed, int level_overlaps, int level_offset) {
+                    return find_x_endpoints_with(engine, storage, level, level_transposed, level_overlaps, level_offset);
+                });
+        } else {
+            endpoints = find_x_endpoints_with(engine, storage, image, image_transposed, max_overlaps, max_offset);
+        }
+        return max_offset;
+    };
+    int x_offset = scan(binary_image, transposed, x_endpoints);
+    int y_offset = scan(transposed, binary_image, y_endpoints);
+    return {x_offset, y_offset};
+}
+
+#endif
@@ -1,50 +1,609 @@
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <cctype>
+#include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <random>
+#include <algorithm>
+#include <filesystem>
+#include <poll.h>
 #include "image.h"
+#include "binary_image.h"
+#include "pipeline.h"
+#include "line_scan.h"
+#include "task.h"
+#include "unix_socket.h"
+#include "worker_process.h"
+#include "prefetch.h"
 #include "debug.h"
 
-Image process_image(const Image& image, Profiler& profiler);
+// What batch and server mode report for each image. x_lines hold the x
+// coordinates of each vertical grid line at y = 0 and y = height - 1,
+// y_lines the y coordinates of each horizontal one at x = 0 and
+// x = width - 1, both sorted.
+struct ImageSummary {
+    std::string input_path;
+    int width = 0, height = 0;
+    endpoints_t x_lines, y_lines;
+    double seconds = 0.0;
+    bool ok = false, crashed = false;
+};
 
-int main() {
+Image8 process_image(ImageView<std::uint8_t> image, Profiler& profiler, std::ostream& log,
+                     const std::string& binary_output_path, ImageSummary& summary);
+
+// process_image needs at least an RGB image.
+bool is_processable(const Image8& image) {
+    return image.width() > 0 && image.height() > 0 && image.nr_channels() >= 3;
+}
+
+// With a prefetcher, the input is taken from it (as file number
+// prefetch_index) instead of being read from input_path.
+struct ImageJob {
+    std::string input_path, output_path, binary_output_path;
+    FilePrefetcher* prefetcher = nullptr;
+    std::size_t prefetch_index = 0;
+};
+
+ImageJob make_job(const std::string& input_path, const std::string& output_dir = "output") {
+    auto stem = std::filesystem::path(input_path).stem().string();
+    auto dir = std::filesystem::path(output_dir);
+    return {input_path, (dir / (stem + ".png")).string(), (dir / (stem + "_bin.png")).string()};
+}
+
+// Decoding and encoding run on io_pool, process_image on compute_pool (whose
+// inner loops fan out to ThreadPool::global()). Each image's report is
+// buffered and printed in one piece when it is done; in batch mode only the
+// one-line summary is printed.
+Task<void> run_job(ImageJob job, ThreadPool& io_pool, ThreadPool& compute_pool, AsyncSemaphore& in_flight,
+                   ImageSummary& summary, bool verbose) {
+    std::ostringstream log;
     Profiler profiler;
     profiler.start();
+    summary.input_path = job.input_path;
 
-    Image image;
-    profiler.profile("loading image", [&] {
-        image = load_image("input/1.jpg");
-    });
-    
-    std::cout << "width: " << image.width() << " height: " << image.height() << " nr_channels: " << image.nr_channels() << '\n';
-    std::cout << "nr_pixels: " << image.width() * image.height() << '\n';
+    co_await schedule_on(io_pool);
+    Image8 image;
+    if (job.prefetcher) {
+        file_bytes_t bytes;
+        profiler.profile("waiting for input", [&] {
+            bytes = job.prefetcher->take(job.prefetch_index);
+        });
+        profiler.profile("decoding image", [&] {
+            if (!bytes.empty()) image = load_image_from_memory(bytes.data(), bytes.size(), Layout::planar);
+        });
+    } else {
+        profiler.profile("loading image", [&] {
+            image = load_image(job.input_path, Layout::planar);
+        });
+    }
 
-    Image output= process_image(image, profiler);
+    if (is_processable(image)) {
+        summary.width = image.width();
+        summary.height = image.height();
+        log << job.input_path << '\n';
+        log << "width: " << image.width() << " height: " << image.height() << " nr_channels: " << image.nr_channels() << '\n';
+        log << "nr_pixels: " << image.width() * image.height() << '\n';
 
-    profiler.profile("saving image", [&] {
-        save_image(output, "output/1.png");
-    });
+        co_await schedule_on(compute_pool);
+        Image8 output = process_image(image, profiler, log, job.binary_output_path, summary);
+        image = {};
+
+        co_await schedule_on(io_pool);
+        profiler.profile("saving image", [&] {
+            save_image(output, job.output_path);
+        });
+        summary.ok = true;
+    }
 
     profiler.stop();
-    profiler.print_results();
+    summary.seconds = profiler.total();
+    if (verbose) {
+        profiler.print_results(log);
+    } else {
+        log.str("");
+        log << (summary.ok ? "done   " : "FAILED ") << job.input_path;
+        if (summary.ok) {
+            log << ": " << summary.width << "x" << summary.height << ", "
+                << summary.x_lines.size() << " x-lines, " << summary.y_lines.size() << " y-lines, "
+                << std::fixed << std::setprecision(3) << summary.seconds << "s";
+        }
+        log << '\n';
+    }
+    std::cout << log.str() << std::flush;
+    in_flight.release();
+}
+
+// At most in_flight's count of images are between "start loading" and
+// "saved", so loading image N + 1 and saving image N - 1 overlap with
+// processing image N without decoded images piling up behind a slow stage.
+Task<void> submit_jobs(std::vector<ImageJob> jobs, ThreadPool& io_pool, ThreadPool& compute_pool,
+                       AsyncSemaphore& in_flight, WaitGroup& group,
+                       std::vector<ImageSummary>& summaries, bool verbose) {
+    for (std::size_t k = 0; k < jobs.size(); ++k) {
+        co_await in_flight.acquire();
+        spawn(run_job(jobs[k], io_pool, compute_pool, in_flight, summaries[k], verbose), group);
+    }
+}
+
+bool is_image_file(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    for (auto known : {".jpg", ".jpeg", ".png", ".bmp", ".tga", ".gif", ".pgm", ".ppm", ".psd", ".hdr"}) {
+        if (extension == known) return true;
+    }
+    return false;
+}
+
+// A directory yields its image files in name order; anything else is read
+// as a list of paths, one per line.
+std::vector<std::string> collect_batch_inputs(const std::string& path) {
+    std::vector<std::string> inputs;
+    if (std::filesystem::is_directory(path)) {
+        for (auto& entry : std::filesystem::directory_iterator(path)) {
+            if (entry.is_regular_file() && is_image_file(entry.path())) inputs.push_back(entry.path().string());
+        }
+        std::sort(inputs.begin(), inputs.end());
+        return inputs;
+    }
+
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open batch list at path: " << path << '\n';
+        return inputs;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) inputs.push_back(line);
+    }
+    return inputs;
+}
+
+void write_summary(const std::vector<ImageSummary>& summaries, const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Failed to write summary at path: " << path << '\n';
+        return;
+    }
+    file << "input,width,height,x_lines,y_lines,seconds,status\n";
+    for (auto& summary : summaries) {
+        file << summary.input_path << ',' << summary.width << ',' << summary.height << ','
+             << summary.x_lines.size() << ',' << summary.y_lines.size() << ','
+             << std::fixed << std::setprecision(4) << summary.seconds << ','
+             << (summary.ok ? "ok" : summary.crashed ? "crashed" : "failed") << '\n';
+    }
+}
+
+void print_throughput(const std::vector<ImageSummary>& summaries, double seconds) {
+    int nr_ok = 0;
+    double megapixels = 0.0;
+    for (auto& summary : summaries) {
+        if (!summary.ok) continue;
+        ++nr_ok;
+        megapixels += summary.width * static_cast<double>(summary.height) / 1e6;
+    }
+    std::cout << "processed " << nr_ok << "/" << summaries.size() << " images in "
+              << std::fixed << std::setprecision(3) << seconds << "s: "
+              << std::setprecision(2) << nr_ok / seconds << " images/s, "
+              << megapixels / seconds << " MP/s\n";
+}
+
+// Grid geometry and stage timings returned for each server request:
+//     size <width> <height>
+//     x_lines <n>, then n lines "<x at y = 0> <x at y = height - 1>"
+//     y_lines <n>, then n lines "<y at x = 0> <y at x = width - 1>"
+//     timings <n>, then n lines "<seconds> <stage>"
+std::string format_grid_report(const ImageSummary& summary, const Profiler& profiler) {
+    std::ostringstream out;
+    out << "size " << summary.width << ' ' << summary.height << '\n';
+    out << "x_lines " << summary.x_lines.size() << '\n';
+    for (auto [lower, upper] : summary.x_lines) out << lower << ' ' << upper << '\n';
+    out << "y_lines " << summary.y_lines.size() << '\n';
+    for (auto [left, right] : summary.y_lines) out << left << ' ' << right << '\n';
+    out << "timings " << profiler.results().size() << '\n';
+    for (auto& [name, seconds] : profiler.results()) {
+        out << std::fixed << std::setprecision(6) << seconds << ' ' << name << '\n';
+    }
+    return out.str();
+}
+
+// Serves requests from one client until it disconnects (see unix_socket.h
+// for the protocol). Images are processed on the connection's thread; the
+// parallel loops inside run on the global pool and every buffer comes from
+// the global buffer pool, both of which stay warm between requests. Returns
+// true if the client asked the server to shut down.
+bool serve_connection(int fd) {
+    constexpr std::size_t max_image_bytes = std::size_t(1) << 30;
+    SocketReader reader(fd);
+    std::string request;
+    std::vector<unsigned char> bytes;
+    while (reader.read_line(request)) {
+        if (request == "shutdown") return true;
+
+        Profiler profiler;
+        profiler.start();
+        ImageSummary summary;
+        Image8 image;
+        std::string error;
+        if (request.rfind("path ", 0) == 0) {
+            summary.input_path = request.substr(5);
+            profiler.profile("loading image", [&] {
+                image = load_image(summary.input_path, Layout::planar);
+            });
+        } else if (request.rfind("image ", 0) == 0) {
+            std::size_t size = std::strtoull(request.c_str() + 6, nullptr, 10);
+            if (size == 0 || size > max_image_bytes) {
+                // The payload cannot be skipped reliably, so drop the connection.
+                write_all(fd, "error bad image size\n");
+                return false;
+            }
+            if (!reader.read_bytes(bytes, size)) return false;
+            profiler.profile("decoding image", [&] {
+                image = load_image_from_memory(bytes.data(), bytes.size(), Layout::planar);
+            });
+        } else {
+            error = "unknown request";
+        }
+        if (error.empty() && !is_processable(image)) error = "failed to load image";
+
+        std::string response;
+        if (error.empty()) {
+            summary.width = image.width();
+            summary.height = image.height();
+            std::ostringstream log;
+            process_image(image, profiler, log, "", summary);
+            profiler.stop();
+            std::string report = format_grid_report(summary, profiler);
+            response = "ok " + std::to_string(report.size()) + "\n" + report;
+        } else {
+            response = "error " + error + "\n";
+        }
+        if (!write_all(fd, response)) return false;
+    }
+    return false;
+}
+
+// Accepts connections on socket_path until a client sends shutdown, then
+// waits for the other open connections to close.
+int serve(const std::string& socket_path) {
+    int listen_fd = listen_unix(socket_path);
+    if (listen_fd < 0) return 1;
+    std::cout << "listening on " << socket_path << std::endl;
 
+    std::atomic<bool> stop{false};
+    WaitGroup connections;
+    while (!stop) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (!stop) std::cerr << "Failed to accept connection: " << std::strerror(errno) << '\n';
+            break;
+        }
+        connections.add();
+        std::thread([&, fd] {
+            if (serve_connection(fd)) {
+                stop = true;
+                // Wakes the accept() above.
+                shutdown(listen_fd, SHUT_RDWR);
+            }
+            close(fd);
+            connections.done();
+        }).detach();
+    }
+    connections.wait();
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    BufferPool::global().print_stats();
     return 0;
 }
 
-Image process_image(const Image& image, Profiler& profiler) {
+// One line per image from a worker process to the coordinator:
+//     done <index> <ok> <width> <height> <seconds> <n> <x lines...> <m> <y lines...>
+std::string encode_result(std::size_t index, const ImageSummary& summary) {
+    std::ostringstream out;
+    out << "done " << index << ' ' << summary.ok << ' ' << summary.width << ' ' << summary.height << ' '
+        << std::setprecision(9) << summary.seconds;
+    for (auto* lines : {&summary.x_lines, &summary.y_lines}) {
+        out << ' ' << lines->size();
+        for (auto [first, second] : *lines) out << ' ' << first << ' ' << second;
+    }
+    out << '\n';
+    return out.str();
+}
+
+bool decode_result(const std::string& line, std::size_t& index, ImageSummary& summary) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command >> index >> summary.ok >> summary.width >> summary.height >> summary.seconds;
+    for (auto* lines : {&summary.x_lines, &summary.y_lines}) {
+        std::size_t n = 0;
+        in >> n;
+        lines->resize(in ? n : 0);
+        for (auto& [first, second] : *lines) in >> first >> second;
+    }
+    return command == "done" && !in.fail();
+}
+
+// Worker side of coordinate(): processes "job <index> <path>" requests from
+// fd one at a time until the coordinator closes its end.
+int run_worker(int fd, const std::string& output_dir) {
+    ThreadPool io_pool(1), compute_pool(1);
+    SocketReader reader(fd);
+    std::string request;
+    while (reader.read_line(request)) {
+        std::istringstream in(request);
+        std::string command, path;
+        std::size_t index = 0;
+        in >> command >> index;
+        in.ignore(1);
+        std::getline(in, path);
+        if (command != "job") continue;
+
+        ImageSummary summary;
+        AsyncSemaphore in_flight(1);
+        WaitGroup group;
+        spawn(run_job(make_job(path, output_dir), io_pool, compute_pool, in_flight, summary, false), group);
+        group.wait();
+        if (!write_all(fd, encode_result(index, summary))) break;
+    }
+    return 0;
+}
+
+// Shards inputs over nr_processes copies of this binary in worker mode.
+// Images are handed out one at a time to whichever worker is idle, so a run
+// of slow images does not hold up a fixed shard. A worker that dies takes
+// only its current image with it: that image is recorded as crashed and a
+// fresh worker takes over. Results land in summaries in input order.
+void coordinate(const std::vector<std::string>& inputs, int nr_processes, const std::string& output_dir,
+                std::vector<ImageSummary>& summaries) {
+    struct Slot {
+        WorkerProcess process;
+        long job = -1;
+        std::string received;
+    };
+    std::vector<Slot> slots(std::min<std::size_t>(std::max(nr_processes, 1), inputs.size()));
+    std::size_t next_job = 0, nr_finished = 0;
+
+    for (std::size_t k = 0; k < inputs.size(); ++k) summaries[k].input_path = inputs[k];
+
+    // Gives slot the next image, or closes its socket (which ends the
+    // worker) once there are none left.
+    auto hand_out = [&](Slot& slot) {
+        slot.job = -1;
+        if (next_job == inputs.size()) {
+            close(slot.process.fd);
+            slot.process.fd = -1;
+            return;
+        }
+        slot.job = next_job++;
+        write_all(slot.process.fd, "job " + std::to_string(slot.job) + " " + inputs[slot.job] + "\n");
+    };
+    auto start = [&](Slot& slot) {
+        slot.process = start_worker_process({"--output", output_dir, "--worker"});
+        slot.received.clear();
+        if (slot.process.fd >= 0) hand_out(slot);
+        else slot.job = -1;
+    };
+    for (auto& slot : slots) start(slot);
+
+    while (nr_finished < inputs.size()) {
+        std::vector<pollfd> fds;
+        std::vector<Slot*> busy;
+        for (auto& slot : slots) {
+            if (slot.job < 0) continue;
+            fds.push_back({slot.process.fd, POLLIN, 0});
+            busy.push_back(&slot);
+        }
+        if (fds.empty()) break;
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Failed to poll workers: " << std::strerror(errno) << '\n';
+            break;
+        }
+
+        for (std::size_t k = 0; k < fds.size(); ++k) {
+            if (fds[k].revents == 0) continue;
+            Slot& slot = *busy[k];
+            char buffer[4096];
+            ssize_t n = read(slot.process.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                slot.received.append(buffer, n);
+                std::size_t newline;
+                while (slot.job >= 0 && (newline = slot.received.find('\n')) != std::string::npos) {
+                    std::string line = slot.received.substr(0, newline);
+                    slot.received.erase(0, newline + 1);
+                    std::size_t index;
+                    ImageSummary summary;
+                    if (!decode_result(line, index, summary) || index != static_cast<std::size_t>(slot.job)) continue;
+                    summary.input_path = inputs[index];
+                    summaries[index] = std::move(summary);
+                    ++nr_finished;
+                    hand_out(slot);
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+
+            // The worker is gone with its image unfinished.
+            int status = 0;
+            close(slot.process.fd);
+            waitpid(slot.process.pid, &status, 0);
+            slot.process = {};
+            std::cout << "CRASHED " << inputs[slot.job] << ": worker " << describe_exit_status(status) << '\n';
+            summaries[slot.job].crashed = true;
+            ++nr_finished;
+            start(slot);
+        }
+    }
+
+    for (auto& slot : slots) {
+        if (slot.process.fd >= 0) close(slot.process.fd);
+        if (slot.process.pid > 0) waitpid(slot.process.pid, nullptr, 0);
+    }
+}
+
+// Usage:
+//   main [--max-skew auto | <degrees> | <n>px] [--pyramid <levels>] ...
+//   main [file...]
+//   main --batch <dir | list file> [--output <dir>] [--summary <csv>] [--workers <n>] [--prefetch <depth>]
+//   main --batch <dir | list file> --processes <n> [--output <dir>] [--summary <csv>]
+//   main --serve <socket path>
+// Without arguments input/1.jpg is processed. Batch mode keeps one process,
+// one set of pools and one buffer pool across all images, runs up to
+// `workers` images through process_image at once, and prints one line per
+// image plus aggregate throughput instead of full per-image reports. Its
+// inputs are read ahead with up to `depth` reads in flight (0 turns this
+// off; see prefetch.h). With --processes, a batch is sharded over that many
+// worker processes instead (see coordinate); each gets an equal share of
+// the cores unless COUNT_DOTS_THREADS is set. Server mode answers requests
+// from `client` (or anything speaking the protocol in unix_socket.h) until
+// told to shut down. --max-skew, in any mode, only tests candidate lines
+// whose ends are at most that far apart (see SkewBound); the default tests
+// every pair. --pyramid searches coarse-to-fine from that many halvings
+// (see find_x_endpoints_pyramid); keep 2^levels well under a tenth of the
+// grid spacing.
+int main(int argc, char** argv) {
+    std::string batch_path, output_dir = "output", summary_path, socket_path, max_skew, pyramid_levels;
+    int nr_workers = 0, nr_processes = 0, worker_fd = -1, prefetch_depth = 8;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--batch" && has_value) batch_path = argv[++i];
+        else if (arg == "--output" && has_value) output_dir = argv[++i];
+        else if (arg == "--summary" && has_value) summary_path = argv[++i];
+        else if (arg == "--workers" && has_value) nr_workers = std::atoi(argv[++i]);
+        else if (arg == "--serve" && has_value) socket_path = argv[++i];
+        else if (arg == "--max-skew" && has_value) max_skew = argv[++i];
+        else if (arg == "--pyramid" && has_value) pyramid_levels = argv[++i];
+        else if (arg == "--prefetch" && has_value) prefetch_depth = std::atoi(argv[++i]);
+        else if (arg == "--processes" && has_value) nr_processes = std::atoi(argv[++i]);
+        else if (arg == "--worker" && has_value) worker_fd = std::atoi(argv[++i]);
+        else inputs.push_back(arg);
+    }
+    if (!max_skew.empty()) {
+        // Through the environment, so worker processes pick it up as well.
+        SkewBound skew;
+        if (!parse_skew_bound(max_skew, skew)) {
+            std::cerr << "Invalid --max-skew (expected auto, <degrees> or <n>px): " << max_skew << '\n';
+            return 1;
+        }
+        setenv("COUNT_DOTS_MAX_SKEW", max_skew.c_str(), 1);
+    }
+    if (!pyramid_levels.empty()) {
+        if (pyramid_levels.find_first_not_of("0123456789") != std::string::npos) {
+            std::cerr << "Invalid --pyramid (expected a number of levels): " << pyramid_levels << '\n';
+            return 1;
+        }
+        setenv("COUNT_DOTS_PYRAMID_LEVELS", pyramid_levels.c_str(), 1);
+    }
+    if (worker_fd >= 0) return run_worker(worker_fd, output_dir);
+    if (!socket_path.empty()) return serve(socket_path);
+
+    bool batch = !batch_path.empty();
+    if (batch) {
+        auto listed = collect_batch_inputs(batch_path);
+        inputs.insert(inputs.end(), listed.begin(), listed.end());
+        if (inputs.empty()) {
+            std::cerr << "No images found in: " << batch_path << '\n';
+            return 1;
+        }
+        std::filesystem::create_directories(output_dir);
+        if (summary_path.empty()) summary_path = (std::filesystem::path(output_dir) / "summary.csv").string();
+    }
+
+    if (batch && nr_processes > 1) {
+        if (!std::getenv("COUNT_DOTS_THREADS")) {
+            int nr_threads = std::max(1, ThreadPool::default_nr_threads() / nr_processes);
+            setenv("COUNT_DOTS_THREADS", std::to_string(nr_threads).c_str(), 0);
+        }
+        std::vector<ImageSummary> summaries(inputs.size());
+        auto start = std::chrono::steady_clock::now();
+        coordinate(inputs, nr_processes, output_dir, summaries);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        write_summary(summaries, summary_path);
+        print_throughput(summaries, elapsed.count());
+        return 0;
+    }
+
+    std::vector<ImageJob> jobs;
+    for (auto& input : inputs) jobs.push_back(make_job(input, output_dir));
+    if (jobs.empty()) jobs.push_back({"input/1.jpg", "output/1.png", "output/1_bin.png"});
+
+    // One image loading and one saving per compute worker keeps every
+    // worker busy without holding more decoded images than that.
+    if (nr_workers <= 0) nr_workers = batch ? ThreadPool::default_nr_threads() : 1;
+    int max_in_flight = nr_workers + 2;
+    ThreadPool io_pool(2), compute_pool(nr_workers);
+    AsyncSemaphore in_flight(max_in_flight);
+    WaitGroup group;
+    std::vector<ImageSummary> summaries(jobs.size());
+
+    // Batch inputs are read ahead of the jobs that decode them, far enough
+    // that every image in flight can already be in memory.
+    std::unique_ptr<FilePrefetcher> prefetcher;
+    if (batch && prefetch_depth > 0) {
+        prefetcher = std::make_unique<FilePrefetcher>(inputs, prefetch_depth, std::max(32, max_in_flight + prefetch_depth));
+        for (std::size_t k = 0; k < jobs.size(); ++k) {
+            jobs[k].prefetcher = prefetcher.get();
+            jobs[k].prefetch_index = k;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    spawn(submit_jobs(jobs, io_pool, compute_pool, in_flight, group, summaries, !batch), group);
+    group.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (batch) {
+        write_summary(summaries, summary_path);
+        print_throughput(summaries, elapsed.count());
+    }
+    if (prefetcher) prefetcher->print_stats();
+    BufferPool::global().print_stats();
+    return 0;
+}
+
+Image8 process_image(ImageView<std::uint8_t> image, Profiler& profiler, std::ostream& log,
+                     const std::string& binary_output_path, ImageSummary& summary) {
     auto width = image.width();
     auto height = image.height();
     auto nr_channels = image.nr_channels();
 
-    Image greyscale_image{width, height, 1};
-    profiler.profile("greyscaling image", [&] {
-        greyscale_image.loop_2d([&] (int i, int j) {
-            greyscale_image(i, j) = (image(i, j, 0) + image(i, j, 1) + image(i, j, 2)) / 3;
+    Image8 greyscale_image, blurred_image, main_grid_image;
+    ImageView<std::uint8_t> smooth_image;
+    BinaryImage binary_image;
+
+    Pipeline pipeline;
+    std::size_t plane_bytes = static_cast<std::size_t>(width) * height;
+    auto input_buffer = pipeline.add_buffer("input", plane_bytes * nr_channels, BufferRole::input);
+    auto greyscale_buffer = pipeline.add_buffer("greyscale", plane_bytes, BufferRole::intermediate,
+                                                [&] { greyscale_image = {}; smooth_image = {}; });
+    auto blurred_buffer = pipeline.add_buffer("blurred", plane_bytes, BufferRole::intermediate,
+                                              [&] { blurred_image = {}; });
+    auto binary_buffer = pipeline.add_buffer("binary", BinaryImage::storage_bytes(width, height), BufferRole::intermediate,
+                                             [&] { binary_image = {}; });
+    auto grid_buffer = pipeline.add_buffer("grid", plane_bytes * 3, BufferRole::output);
+
+    pipeline.add_stage("greyscaling image", {input_buffer}, {greyscale_buffer}, [&] {
+        greyscale_image = Image8{width, height, 1, Initialization::uninitialized};
+        greyscale_image.loop_rows(execution::par, [&] (int j, std::uint8_t* row) {
+            const std::uint8_t* in = image.row(j);
+            auto pixel_stride = image.pixel_stride(), channel_stride = image.channel_stride();
+            for (int i = 0; i < width; ++i, in += pixel_stride) {
+                row[i] = (in[0] + in[channel_stride] + in[2 * channel_stride] + 1) / 3;
+            }
         });
     });
 
-    Image smooth_image{width, height, 1};
-    profiler.profile("gaussian blur", [&] {
-        Kernel gaussian_filter(5);
+    pipeline.add_stage("gaussian blur", {greyscale_buffer}, {blurred_buffer}, [&] {
+        Kernel<float> gaussian_filter(5);
         gaussian_filter = {
             2, 4, 5, 4, 2,
             4, 9, 12, 9, 4,
@@ -52,58 +611,25 @@ Image process_image(const Image& image, Profiler& profiler) {
             4, 9, 12, 9, 4,
             2, 4, 5, 4, 2,
         };
-        smooth_image = convolve_2d(greyscale_image, gaussian_filter, 159);
+        blurred_image = convolve_2d(greyscale_image.const_view(), gaussian_filter, 159);
         smooth_image = greyscale_image;
     });
 
-    Image binary_image;
-    profiler.profile("thresholding", [&] {
+    pipeline.add_stage("thresholding", {greyscale_buffer}, {binary_buffer}, [&] {
         float th = compute_threshold(smooth_image, 1000);
-        std::cout << "threshold: " << th << '\n';
+        log << "threshold: " << th << '\n';
         binary_image = apply_thresholding(smooth_image, th);
-        save_image(binary_image, "output/1_bin.png");
+        if (!binary_output_path.empty()) save_image(binary_image, binary_output_path);
     });
 
     endpoints_t raw_x_endpoints, raw_y_endpoints;
-    profiler.profile("raw endpoints", [&] {
+    pipeline.add_stage("raw endpoints", {binary_buffer}, {}, [&] {
         int max_overlaps = 10;
-
-        for (int i = 1; i < width - 1; ++i) {
-            for (int j = 1; j < width - 1; ++j) {
-                bool flag = true;
-                int curr_overlaps = 0;
-                draw_line(i, 0, j, height - 1, [&] (int x, int y) {
-                    if (binary_image(x, y) == 1.0) ++curr_overlaps;
-                    if (binary_image(x, y) == 0.0) curr_overlaps = 0;
-                    if (curr_overlaps > max_overlaps) {
-                        flag = false;
-                        return -1;
-                    }
-                    return 0;
-                });
-                if (flag) {
-                    raw_x_endpoints.emplace_back(i, j);
-                }
-            }
-        }
-
-        for (int i = 1; i < height - 1; ++i) {
-            for (int j = 1; j < height - 1; ++j) {
-                bool flag = true;
-                int curr_overlaps = 0;
-                draw_line(0, i, width - 1, j, [&] (int x, int y) {
-                    if (binary_image(x, y) == 1.0) ++curr_overlaps;
-                    if (binary_image(x, y) == 0.0) curr_overlaps = 0;
-                    if (curr_overlaps > max_overlaps) {
-                        flag = false;
-                        return -1;
-                    }
-                    return 0;
-                });
-                if (flag) {
-                    raw_y_endpoints.emplace_back(i, j);
-                }
-            }
+        auto [x_offset, y_offset] = find_raw_endpoints(binary_image, max_overlaps, ScanEngine::slope_batched,
+                                                       BinaryStorage::row_major, raw_x_endpoints, raw_y_endpoints,
+                                                       skew_bound_from_env(), pyramid_levels_from_env());
+        if (x_offset >= 0 || y_offset >= 0) {
+            log << "max end offset: x lines " << x_offset << " px, y lines " << y_offset << " px\n";
         }
     });
 
@@ -113,7 +639,7 @@ Image process_image(const Image& image, Profiler& profiler) {
     endpoints_t extrapolated_x_endpoints, extrapolated_y_endpoints;
     float max_flt = std::max(width, height);
     float grid_width = max_flt;
-    profiler.profile("processing endpoints", [&] {
+    pipeline.add_stage("processing endpoints", {}, {}, [&] {
         x_endpoints = process_endpoints(raw_x_endpoints, differences);
         y_endpoints = process_endpoints(raw_y_endpoints, differences);
 
@@ -135,7 +661,7 @@ Image process_image(const Image& image, Profiler& profiler) {
         }
     });
 
-    profiler.profile("interpolating", [&] {
+    pipeline.add_stage("interpolating", {}, {}, [&] {
         for (int i = 0, n = x_endpoints.size(); i < n - 1; ++i) {
             float x1_l = x_endpoints[i].first, x1_u = x_endpoints[i].second;
             float x2_l = x_endpoints[i + 1].first, x2_u = x_endpoints[i + 1].second;
@@ -173,8 +699,10 @@ Image process_image(const Image& image, Profiler& profiler) {
         }
     });
 
-    profiler.profile("extrapolating", [&] {
-        for (int i = 1;; ++i) {
+    pipeline.add_stage("extrapolating", {}, {}, [&] {
+        // A plate without a single clear line in one direction has nothing
+        // to extrapolate from.
+        for (int i = 1; !x_endpoints.empty(); ++i) {
             float x_l = x_endpoints.front().first, x_u = x_endpoints.front().second;
             float m = (height - 1) / (x_u - x_l);
             float x0 = (x_l + x_u) / 2 - grid_width * i;
@@ -184,7 +712,7 @@ Image process_image(const Image& image, Profiler& profiler) {
             extrapolated_x_endpoints.push_back({(int)std::round(xt_l), (int)std::round(xt_u)});
         }
 
-        for (int i = 1;; ++i) {
+        for (int i = 1; !x_endpoints.empty(); ++i) {
             float x_l = x_endpoints.back().first, x_u = x_endpoints.back().second;
             float m = (height - 1) / (x_u - x_l);
             float x0 = (x_l + x_u) / 2 + grid_width * i;
@@ -194,7 +722,7 @@ Image process_image(const Image& image, Profiler& profiler) {
             extrapolated_x_endpoints.push_back({(int)std::round(xt_l), (int)std::round(xt_u)});
         }
 
-        for (int i = 1;; ++i) {
+        for (int i = 1; !y_endpoints.empty(); ++i) {
             float y_l = y_endpoints.front().first, y_u = y_endpoints.front().second;
             float m = (y_u - y_l) / (width - 1);
             float y0 = (y_l + y_u) / 2 - grid_width * i;
@@ -204,7 +732,7 @@ Image process_image(const Image& image, Profiler& profiler) {
             extrapolated_y_endpoints.push_back({(int)std::round(yt_l), (int)std::round(yt_u)});
         }
 
-        for (int i = 1;; ++i) {
+        for (int i = 1; !y_endpoints.empty(); ++i) {
             float y_l = y_endpoints.back().first, y_u = y_endpoints.back().second;
             float m = (y_u - y_l) / (width - 1);
             float y0 = (y_l + y_u) / 2 + grid_width * i;
@@ -215,28 +743,51 @@ Image process_image(const Image& image, Profiler& profiler) {
         }
     });
 
-    Image main_grid_image{width, height, 3};
-    profiler.profile("result", [&] () {
-        std::vector<std::pair<vec2, vec2>> final_endpoints;
+    pipeline.add_stage("result", {}, {grid_buffer}, [&] () {
+        main_grid_image = Image8{width, height, 3};
         x_endpoints.insert(x_endpoints.end(), interpolated_x_endpoints.begin(), interpolated_x_endpoints.end());
         x_endpoints.insert(x_endpoints.end(), extrapolated_x_endpoints.begin(), extrapolated_x_endpoints.end());
         y_endpoints.insert(y_endpoints.end(), interpolated_y_endpoints.begin(), interpolated_y_endpoints.end());
         y_endpoints.insert(y_endpoints.end(), extrapolated_y_endpoints.begin(), extrapolated_y_endpoints.end());
+        summary.x_lines = x_endpoints;
+        summary.y_lines = y_endpoints;
+        sort_endpoints(summary.x_lines);
+        sort_endpoints(summary.y_lines);
+        // Near-vertical x lines come as column runs, written straight into
+        // the green channel. Near-horizontal y lines come as row runs, which
+        // are bucketed by row first so they are written in storage order.
+        // Both are clipped, since extrapolated lines may end outside the image.
+        auto green = main_grid_image.view().channel(1);
+        auto pixel_stride = green.pixel_stride();
         for (auto& p : x_endpoints) {
-            final_endpoints.emplace_back(vec2(p.first, 0), vec2(p.second, height - 1));
+            draw_line_columns(p.first, 0, p.second, height - 1, [&] (int i, int j_first, int j_last) {
+                if (i < 0 || i >= width) return 0;
+                for (int j = std::max(j_first, 0); j <= std::min(j_last, height - 1); ++j) {
+                    green.row(j)[i * pixel_stride] = pixel_traits<std::uint8_t>::max();
+                }
+                return 0;
+            });
         }
+        std::vector<std::vector<std::pair<int, int>>> row_spans(height);
         for (auto& p : y_endpoints) {
-            final_endpoints.emplace_back(vec2(0, p.first), vec2(width - 1, p.second));
-        }
-        for (auto [p1, p2] : final_endpoints) {
-            draw_line(p1.x, p1.y, p2.x, p2.y, [&] (int i, int j) {
-                if (!main_grid_image.is_valid_index(i, j)) return 0;
-                main_grid_image(i, j, 1) = 1.0;
+            draw_line_rows(0, p.first, width - 1, p.second, [&] (int j, int i_first, int i_last) {
+                i_first = std::max(i_first, 0);
+                i_last = std::min(i_last, width - 1);
+                if (j >= 0 && j < height && i_first <= i_last) row_spans[j].emplace_back(i_first, i_last);
                 return 0;
             });
         }
+        green.loop_rows([&] (int j, std::uint8_t* row) {
+            for (auto [i_first, i_last] : row_spans[j]) {
+                for (int i = i_first; i <= i_last; ++i) {
+                    row[i * pixel_stride] = pixel_traits<std::uint8_t>::max();
+                }
+            }
+        });
     });
 
-    Image output(main_grid_image);
-    return output;
+    pipeline.print_plan(log);
+    pipeline.run(profiler);
+    pipeline.print_placement(log);
+    return main_grid_image;
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#ifndef PIPELINE_H_INCLUDED
+#define PIPELINE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include "debug.h"
+#include "thread_pool.h"
+
+enum class BufferRole {
+    input,          // owned by the caller, live for the whole run
+    intermediate,   // allocated by its first writer, released after its last use
+    output          // allocated by its first writer, handed back to the caller
+};
+
+// Runs a fixed sequence of stages that declare which buffers they read and
+// write. From those declarations it works out when each buffer is born and
+// when it dies, releases intermediates right after their last use and
+// reports the resulting peak footprint. Released blocks go back to the
+// BufferPool, so a later stage's allocation of the same size reuses them.
+class Pipeline {
+public:
+    int add_buffer(std::string name, std::size_t bytes, BufferRole role, std::function<void()> release = {}) {
+        _buffers.push_back({std::move(name), bytes, role, std::move(release)});
+        return static_cast<int>(_buffers.size()) - 1;
+    }
+
+    void add_stage(std::string name, std::vector<int> inputs, std::vector<int> outputs, std::function<void()> run) {
+        _stages.push_back({std::move(name), std::move(inputs), std::move(outputs), std::move(run)});
+    }
+
+    // Bytes live while stage s runs: inputs for the whole run, outputs from
+    // their first writer to the end, intermediates from their first writer
+    // to their last use.
+    std::vector<std::size_t> live_bytes_per_stage() const {
+        auto [first, last] = lifetimes();
+        std::vector<std::size_t> live(_stages.size(), 0);
+        for (std::size_t b = 0; b < _buffers.size(); ++b) {
+            if (first[b] < 0) continue;
+            for (int s = first[b]; s <= last[b]; ++s) live[s] += _buffers[b].bytes;
+        }
+        return live;
+    }
+
+    std::size_t planned_peak_bytes() const {
+        auto live = live_bytes_per_stage();
+        return live.empty() ? 0 : *std::max_element(live.begin(), live.end());
+    }
+
+    // Footprint if nothing were released early, for comparison.
+    std::size_t unplanned_peak_bytes() const {
+        std::size_t total = 0;
+        for (auto& buffer : _buffers) total += buffer.bytes;
+        return total;
+    }
+
+    void print_plan(std::ostream& out = std::cout) const {
+        auto [first, last] = lifetimes();
+        out << "buffer plan:\n";
+        for (std::size_t b = 0; b < _buffers.size(); ++b) {
+            if (first[b] < 0) continue;
+            out << "  " << std::left << std::setw(12) << _buffers[b].name << " "
+                << std::right << std::setw(12) << _buffers[b].bytes << " bytes, live "
+                << _stages[first[b]].name << " -> " << _stages[last[b]].name << '\n';
+        }
+        out << "planned peak: " << planned_peak_bytes() << " bytes ("
+            << unplanned_peak_bytes() << " without release)\n";
+    }
+
+    void run(Profiler& profiler) {
+        auto [first, last] = lifetimes();
+        auto& pool = ThreadPool::global();
+        _placements.assign(_stages.size(), {});
+        for (std::size_t s = 0; s < _stages.size(); ++s) {
+            auto tasks_before = pool.tasks_per_node();
+            int caller_node = CpuTopology::get().current_node();
+            profiler.profile(_stages[s].name, _stages[s].run);
+            auto tasks_after = pool.tasks_per_node();
+            for (std::size_t node = 0; node < tasks_after.size(); ++node) {
+                if (tasks_after[node] > tasks_before[node] || static_cast<int>(node) == caller_node) {
+                    _placements[s].emplace_back(static_cast<int>(node), tasks_after[node] - tasks_before[node]);
+                }
+            }
+
+            for (std::size_t b = 0; b < _buffers.size(); ++b) {
+                auto& buffer = _buffers[b];
+                if (last[b] == static_cast<int>(s) && buffer.role == BufferRole::intermediate && buffer.release) {
+                    buffer.release();
+                }
+            }
+        }
+    }
+
+    // NUMA nodes each stage of the last run() executed on, with the number
+    // of pool tasks run there. The node of the calling thread is always listed.
+    void print_placement(std::ostream& out = std::cout) const {
+        out << "stage placement (" << CpuTopology::get().nr_nodes() << " NUMA nodes):\n";
+        for (std::size_t s = 0; s < _placements.size(); ++s) {
+            out << "  " << std::left << std::setw(20) << _stages[s].name << std::right;
+            for (auto [node, nr_tasks] : _placements[s]) {
+                out << " node " << node << " (" << nr_tasks << " tasks)";
+            }
+            out << '\n';
+        }
+    }
+
+private:
+    struct Buffer {
+        std::string name;
+        std::size_t bytes;
+        BufferRole role;
+        std::function<void()> release;
+    };
+
+    struct Stage {
+        std::string name;
+        std::vector<int> inputs, outputs;
+        std::function<void()> run;
+    };
+
+    // First and last stage index at which each buffer is live, -1 if unused.
+    std::pair<std::vector<int>, std::vector<int>> lifetimes() const {
+        int n = static_cast<int>(_stages.size());
+        std::vector<int> first(_buffers.size(), -1), last(_buffers.size(), -1);
+        for (int s = 0; s < n; ++s) {
+            for (auto* ids : {&_stages[s].inputs, &_stages[s].outputs}) {
+                for (int b : *ids) {
+                    if (first[b] < 0) first[b] = s;
+                    last[b] = s;
+                }
+            }
+        }
+        for (std::size_t b = 0; b < _buffers.size(); ++b) {
+            if (first[b] < 0) continue;
+            if (_buffers[b].role == BufferRole::input) first[b] = 0;
+            if (_buffers[b].role != BufferRole::intermediate) last[b] = n - 1;
+        }
+        return {first, last};
+    }
+
+    std::vector<Buffer> _buffers;
+    std::vector<Stage> _stages;
+    std::vector<std::vector<std::pair<int, long>>> _placements;
+};
+
+#endif
@@ -0,0 +1,436 @@
+#ifndef PREFETCH_H_INCLUDED
+#define PREFETCH_H_INCLUDED
+
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "buffer_pool.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(SYS_io_uring_setup) && defined(SYS_io_uring_enter)
+#define HAS_IO_URING
+#endif
+#endif
+
+using file_bytes_t = std::vector<unsigned char, PoolAllocator<unsigned char>>;
+
+#ifdef HAS_IO_URING
+// The few io_uring operations the prefetcher needs, on the raw system calls
+// (liburing is not a dependency): one submission and one completion ring,
+// reads only, driven by a single thread.
+class IoUring {
+public:
+    explicit IoUring(unsigned __entries) {
+        io_uring_params params{};
+        _fd = static_cast<int>(syscall(SYS_io_uring_setup, __entries, &params));
+        if (_fd < 0) return;
+
+        _sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) _sq_bytes = _cq_bytes = std::max(_sq_bytes, _cq_bytes);
+        _sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+
+        _sq = mmap(nullptr, _sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        _cq = single_mmap ? _sq : mmap(nullptr, _cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        void* sqes = mmap(nullptr, _sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sq == MAP_FAILED || _cq == MAP_FAILED || sqes == MAP_FAILED) {
+            if (sqes != MAP_FAILED) munmap(sqes, _sqes_bytes);
+            unmap_rings();
+            close(_fd);
+            _fd = -1;
+            return;
+        }
+
+        auto sq = static_cast<char*>(_sq);
+        auto cq = static_cast<char*>(_cq);
+        _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        _sqes = static_cast<io_uring_sqe*>(sqes);
+        _entries = params.sq_entries;
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        if (_fd < 0) return;
+        munmap(_sqes, _sqes_bytes);
+        unmap_rings();
+        close(_fd);
+    }
+
+    bool valid() const {
+        return _fd >= 0;
+    }
+
+    // Queues a read of size bytes at offset of fd into buffer. It is handed
+    // to the kernel by the next wait(). False if the ring is full.
+    bool queue_read(int fd, void* buffer, unsigned size, std::uint64_t offset, std::uint64_t user_data) {
+        unsigned tail = *_sq_tail;
+        if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _entries) return false;
+        unsigned index = tail & _sq_mask;
+        io_uring_sqe& sqe = _sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<std::uintptr_t>(buffer);
+        sqe.len = size;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        _sq_array[index] = index;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++_unsubmitted;
+        return true;
+    }
+
+    // Submits queued reads and blocks for the next completion; result is
+    // what read(2) would have returned, or -errno. False if the kernel
+    // refused io_uring_enter.
+    bool wait(std::uint64_t& user_data, int& result) {
+        while (true) {
+            if (peek(user_data, result)) return true;
+            long submitted = syscall(SYS_io_uring_enter, _fd, _unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0) _unsubmitted -= static_cast<unsigned>(submitted);
+            else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+        }
+    }
+
+    // Takes a completion the kernel has already posted, without a system
+    // call; false if there is none.
+    bool peek(std::uint64_t& user_data, int& result) {
+        unsigned head = *_cq_head;
+        if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) return false;
+        const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+        user_data = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    void unmap_rings() {
+        if (_cq != _sq && _cq != MAP_FAILED) munmap(_cq, _cq_bytes);
+        if (_sq != MAP_FAILED) munmap(_sq, _sq_bytes);
+    }
+
+    int _fd = -1;
+    unsigned _entries = 0, _unsubmitted = 0;
+    std::size_t _sq_bytes = 0, _cq_bytes = 0, _sqes_bytes = 0;
+    void* _sq = MAP_FAILED;
+    void* _cq = MAP_FAILED;
+    unsigned *_sq_head = nullptr, *_sq_tail = nullptr, *_sq_array = nullptr;
+    unsigned *_cq_head = nullptr, *_cq_tail = nullptr;
+    unsigned _sq_mask = 0, _cq_mask = 0;
+    io_uring_sqe* _sqes = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+};
+#endif
+
+enum class PrefetchBackend {
+    io_uring,
+    threads
+};
+
+struct PrefetchStats {
+    std::size_t nr_files = 0, bytes_read = 0;
+    double read_seconds = 0.0;  // time with at least one read in flight
+    double wait_seconds = 0.0;  // consumers blocked in take()
+    int queue_depth = 0, peak_in_flight = 0;
+};
+
+// Reads a list of files into memory ahead of their use. Up to queue_depth
+// reads are in flight at once, and no file more than max_ahead places past
+// the oldest one not yet taken is started, which bounds the memory held.
+// io_uring is used where the kernel allows it; otherwise (or with
+// COUNT_DOTS_IO=threads) queue_depth threads do blocking reads.
+class FilePrefetcher {
+public:
+    explicit FilePrefetcher(std::vector<std::string> __paths, int __queue_depth = 8, int __max_ahead = 32) :
+        _paths(std::move(__paths)), _entries(_paths.size()),
+        _queue_depth(std::max(1, __queue_depth)), _max_ahead(std::max<std::size_t>(__max_ahead, _queue_depth)) {
+        const char* env = std::getenv("COUNT_DOTS_IO");
+        bool force_threads = env && std::string(env) == "threads";
+#ifdef HAS_IO_URING
+        if (!force_threads) {
+            auto ring = std::make_unique<IoUring>(_queue_depth);
+            if (ring->valid()) {
+                _backend = PrefetchBackend::io_uring;
+                _readers.emplace_back([this, ring = std::move(ring)] { run_io_uring(*ring); });
+                return;
+            }
+        }
+#endif
+        _backend = PrefetchBackend::threads;
+        for (int t = 0; t < _queue_depth; ++t) {
+            _readers.emplace_back([this] { run_blocking(); });
+        }
+    }
+
+    FilePrefetcher(const FilePrefetcher&) = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+    ~FilePrefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _window.notify_all();
+        for (auto& reader : _readers) reader.join();
+    }
+
+    // Blocks until file index has been read and hands over its contents,
+    // which are empty if it could not be read. Each index is taken once.
+    file_bytes_t take(std::size_t index) {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [&] { return _entries[index].ready; });
+        _stats.wait_seconds += seconds_since(start);
+
+        Entry& entry = _entries[index];
+        entry.taken = true;
+        file_bytes_t bytes = std::move(entry.bytes);
+        while (_oldest_untaken < _entries.size() && _entries[_oldest_untaken].taken) ++_oldest_untaken;
+        lock.unlock();
+        _window.notify_all();
+        return bytes;
+    }
+
+    PrefetchBackend backend() const {
+        return _backend;
+    }
+
+    PrefetchStats stats() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        PrefetchStats stats = _stats;
+        stats.queue_depth = _queue_depth;
+        if (_in_flight > 0) stats.read_seconds += seconds_since(_busy_since);
+        return stats;
+    }
+
+    void print_stats() const {
+        auto s = stats();
+        double megabytes = s.bytes_read / 1e6;
+        std::cout << "prefetch (" << (_backend == PrefetchBackend::io_uring ? "io_uring" : "threads")
+                  << ", queue depth " << s.queue_depth << "): " << s.nr_files << " files, "
+                  << std::fixed << std::setprecision(1) << megabytes << " MB in " << std::setprecision(3) << s.read_seconds
+                  << "s (" << std::setprecision(1) << (s.read_seconds > 0 ? megabytes / s.read_seconds : 0.0) << " MB/s), "
+                  << "peak " << s.peak_in_flight << " in flight, consumers waited " << std::setprecision(3)
+                  << s.wait_seconds << "s\n";
+    }
+
+private:
+    struct Entry {
+        file_bytes_t bytes;
+        bool ready = false, taken = false;
+    };
+
+    static double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Next file to read, once it is inside the window. With block false,
+    // returns false instead of waiting; with block true, only once every
+    // file has been started or the prefetcher is being destroyed.
+    bool claim(std::size_t& index, bool block) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto available = [&] { return _next < _entries.size() && _next < _oldest_untaken + _max_ahead; };
+        if (block) _window.wait(lock, [&] { return _stop || _next == _entries.size() || available(); });
+        if (_stop || !available()) return false;
+        if (_in_flight == 0) _busy_since = std::chrono::steady_clock::now();
+        index = _next++;
+        _stats.peak_in_flight = std::max(_stats.peak_in_flight, ++_in_flight);
+        return true;
+    }
+
+    void publish(std::size_t index, file_bytes_t bytes, bool ok) {
+        if (!ok) {
+            std::cerr << "Failed to read image at path: " << _paths[index] << '\n';
+            bytes.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_in_flight == 0) _stats.read_seconds += seconds_since(_busy_since);
+            ++_stats.nr_files;
+            _stats.bytes_read += bytes.size();
+            _entries[index].bytes = std::move(bytes);
+            _entries[index].ready = true;
+        }
+        _ready.notify_all();
+    }
+
+    // Opens path and sizes bytes for its contents; -1 on failure.
+    static int open_file(const std::string& path, file_bytes_t& bytes) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        struct stat info;
+        if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+            close(fd);
+            return -1;
+        }
+        bytes.resize(info.st_size);
+        return fd;
+    }
+
+    // Reads bytes[done, size) with plain pread calls; false on error.
+    static bool read_rest(int fd, file_bytes_t& bytes, std::size_t done) {
+        while (done < bytes.size()) {
+            ssize_t n = pread(fd, bytes.data() + done, bytes.size() - done, done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) break;
+            done += n;
+        }
+        bytes.resize(done);
+        return true;
+    }
+
+    void run_blocking() {
+        std::size_t index;
+        while (claim(index, true)) {
+            file_bytes_t bytes;
+            int fd = open_file(_paths[index], bytes);
+            bool ok = fd >= 0 && read_rest(fd, bytes, 0);
+            if (fd >= 0) close(fd);
+            publish(index, std::move(bytes), ok);
+        }
+    }
+
+#ifdef HAS_IO_URING
+    // One thread keeps up to queue_depth whole-file reads queued on the ring
+    // and resubmits short reads. If a read fails (for instance on kernels
+    // without IORING_OP_READ) that file is finished with pread instead.
+    // If io_uring_enter itself fails, the reads still queued may be running
+    // in the kernel, so their buffers cannot be published or given back to
+    // the pool: each file is finished with pread into a fresh buffer and the
+    // old one is parked until its completion shows up, or leaked if it never
+    // does before the ring goes away.
+    void run_io_uring(IoUring& ring) {
+        struct Read {
+            std::size_t index;
+            int fd = -1;
+            std::size_t done = 0;
+            file_bytes_t bytes;
+        };
+        constexpr std::size_t max_read_bytes = std::size_t(1) << 30;
+        std::vector<Read> reads(_queue_depth);
+        std::vector<file_bytes_t> parked(_queue_depth);
+        std::vector<int> free_slots;
+        for (int slot = _queue_depth - 1; slot >= 0; --slot) free_slots.push_back(slot);
+
+        auto queue_rest = [&](int slot) {
+            Read& read = reads[slot];
+            unsigned size = static_cast<unsigned>(std::min(read.bytes.size() - read.done, max_read_bytes));
+            return ring.queue_read(read.fd, read.bytes.data() + read.done, size, read.done, slot);
+        };
+        auto finish = [&](int slot, bool ok) {
+            Read& read = reads[slot];
+            close(read.fd);
+            publish(read.index, std::move(read.bytes), ok);
+            read = {};
+            free_slots.push_back(slot);
+        };
+
+        bool ring_ok = true;
+        std::size_t index;
+        while (true) {
+            while (!free_slots.empty() && claim(index, free_slots.size() == reads.size())) {
+                int slot = free_slots.back();
+                free_slots.pop_back();
+                Read& read = reads[slot];
+                read.index = index;
+                read.fd = open_file(_paths[index], read.bytes);
+                if (read.fd < 0) {
+                    publish(index, {}, false);
+                    read = {};
+                    free_slots.push_back(slot);
+                } else if (read.bytes.empty() || !queue_rest(slot)) {
+                    finish(slot, read_rest(read.fd, read.bytes, 0));
+                }
+            }
+            if (free_slots.size() == reads.size()) break;
+
+            std::uint64_t slot;
+            int result;
+            if (!ring.wait(slot, result)) {
+                std::cerr << "io_uring_enter failed: " << std::strerror(errno) << ", reading synchronously\n";
+                ring_ok = false;
+                for (int s = 0; s < _queue_depth; ++s) {
+                    Read& read = reads[s];
+                    if (read.fd < 0) continue;
+                    // Bytes before done were completed and reaped; the kernel
+                    // only writes past them.
+                    file_bytes_t fresh(read.bytes.size());
+                    std::copy(read.bytes.begin(), read.bytes.begin() + read.done, fresh.begin());
+                    parked[s] = std::move(read.bytes);
+                    read.bytes = std::move(fresh);
+                    finish(s, read_rest(read.fd, read.bytes, read.done));
+                }
+                break;
+            }
+            Read& read = reads[slot];
+            if (result < 0) {
+                finish(slot, read_rest(read.fd, read.bytes, read.done));
+            } else if (result == 0) {
+                read.bytes.resize(read.done);
+                finish(slot, true);
+            } else {
+                read.done += result;
+                if (read.done == read.bytes.size()) finish(slot, true);
+                else if (!queue_rest(slot)) finish(slot, read_rest(read.fd, read.bytes, read.done));
+            }
+        }
+        if (ring_ok) return;
+
+        // The remaining files are read synchronously on this thread.
+        run_blocking();
+        std::uint64_t slot;
+        int result;
+        while (ring.peek(slot, result)) parked[slot] = {};
+        // Still possibly being written to once the ring is closed: leaked on purpose.
+        for (auto& bytes : parked) {
+            if (!bytes.empty()) new file_bytes_t(std::move(bytes));
+        }
+    }
+#endif
+
+    std::vector<std::string> _paths;
+    std::vector<Entry> _entries;
+    int _queue_depth;
+    std::size_t _max_ahead;
+    PrefetchBackend _backend;
+    std::vector<std::thread> _readers;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _ready, _window;
+    std::size_t _next = 0, _oldest_untaken = 0;
+    int _in_flight = 0;
+    bool _stop = false;
+    PrefetchStats _stats;
+    std::chrono::steady_clock::time_point _busy_since;
+};
+
+#endif
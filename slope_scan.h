@@ -0,0 +1,178 @@
+#ifndef SLOPE_SCAN_H_INCLUDED
+#define SLOPE_SCAN_H_INCLUDED
+
+#include <bit>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include "image.h"
+#include "binary_image.h"
+#include "thread_pool.h"
+#include "line_pattern.h"
+
+// Slope-batched version of find_x_endpoints. draw_line
+// only looks at coordinate differences, so the lines (i, 0) -> (i + d,
+// height - 1) for a fixed offset d all follow one pattern of steps (dx, y),
+// translated by i. Bit i of row y shifted by dx is then step k of line i,
+// and one 64-bit word of that shifted row advances 64 lines at once.
+// A run of more than max_overlaps consecutive foreground pixels is found
+// by ANDing the last max_overlaps + 1 steps, so the result is exactly that
+// of is_clear_line. Horizontal lines are vertical lines of the transposed
+// image (see find_raw_endpoints). The run-length engine (find_x_endpoints_runs) walks the same
+// steps with a byte counter per line instead of bit chains.
+
+namespace detail {
+    // Rows of a binary image with one zero word of padding on each side.
+    // Any 64-bit window that overlaps a valid line's pixels stays inside.
+    class PaddedBitRows {
+    public:
+        using word_t = BinaryImage::word_t;
+
+        explicit PaddedBitRows(const BinaryImage& image) :
+            _stride(image.words_per_row() + 2), _data(static_cast<std::size_t>(_stride) * image.height(), 0) {
+            for (int j = 0; j < image.height(); ++j) {
+                std::copy(image.row(j), image.row(j) + image.words_per_row(), _data.data() + j * _stride + 1);
+            }
+        }
+
+        // Pixels [bit, bit + 64) of row j as one word, for -64 < bit < 64 * words_per_row.
+        word_t window(int j, int bit) const {
+            int padded = bit + BinaryImage::word_bits;
+            const word_t* p = _data.data() + static_cast<std::size_t>(j) * _stride + padded / BinaryImage::word_bits;
+            int r = padded % BinaryImage::word_bits;
+            return r == 0 ? p[0] : (p[0] >> r) | (p[1] << (BinaryImage::word_bits - r));
+        }
+
+    private:
+        std::size_t _stride;
+        BinaryImage::vector _data;
+    };
+
+    // Lanes in [lane_begin, lane_end) whose line, the pattern's steps
+    // translated by the lane index along rows, never crosses more than max_overlaps
+    // consecutive set pixels. A word stops early once all 64 of its lines
+    // have failed.
+    void scan_slope(const PaddedBitRows& rows, const LinePattern& pattern,
+                    int lane_begin, int lane_end, int max_overlaps, std::vector<int>& clear_lanes) {
+        using word_t = BinaryImage::word_t;
+        constexpr int word_bits = BinaryImage::word_bits;
+        // runs[r]: lines whose current run of set pixels is longer than r.
+        std::vector<word_t> runs(max_overlaps + 1);
+        for (int w = lane_begin / word_bits; w * word_bits < lane_end; ++w) {
+            int first = std::max(lane_begin - w * word_bits, 0);
+            int last = std::min(lane_end - w * word_bits, word_bits);
+            word_t lanes = (last == word_bits ? ~word_t{0} : (word_t{1} << last) - 1) & (~word_t{0} << first);
+            word_t failed = ~lanes;
+
+            std::fill(runs.begin(), runs.end(), 0);
+            for (int k = 0, n = pattern.size(); k < n; ++k) {
+                word_t set = rows.window(pattern.y[k], w * word_bits + pattern.x[k]);
+                for (int r = max_overlaps; r > 0; --r) runs[r] = runs[r - 1] & set;
+                runs[0] = set;
+                failed |= runs[max_overlaps];
+                if (failed == ~word_t{0}) break;
+            }
+            for (word_t clear = ~failed; clear != 0; clear &= clear - 1) {
+                clear_lanes.push_back(w * word_bits + std::countr_zero(clear));
+            }
+        }
+    }
+
+    // Run-length form of scan_slope over the image as 0/255 bytes. Step k
+    // of the walk is row k of the slope's run-length map: the length of
+    // the foreground run ending at each line's k-th pixel, saturated at
+    // max_overlaps + 1. Each row only depends on the one before, so the map
+    // is kept one row at a time together with the running maximum of each
+    // line, which after the last step is that line's verdict. Lines that
+    // have failed are trimmed off both ends of the lane range as it goes.
+    // The inner loop is branch-free byte arithmetic that compilers
+    // vectorize. max_overlaps must be below 255.
+    void scan_slope_runs(const Image8& foreground, const LinePattern& pattern,
+                         int lane_begin, int lane_end, int max_overlaps, std::vector<int>& clear_lanes) {
+        const std::uint8_t limit = static_cast<std::uint8_t>(max_overlaps + 1);
+        std::vector<std::uint8_t> run(lane_end, 0), longest(lane_end, 0);
+        int lo = lane_begin, hi = lane_end;
+        for (int k = 0, n = pattern.size(); k < n && lo < hi; ++k) {
+            // Indexed from the row start: x[k] is negative for negative
+            // offsets, so the row pointer cannot be moved by it.
+            const std::uint8_t* row = foreground.row(pattern.y[k]);
+            int shift = pattern.x[k];
+            for (int i = lo; i < hi; ++i) {
+                std::uint8_t r = std::min<std::uint8_t>(run[i] + 1, limit) & row[i + shift];
+                run[i] = r;
+                longest[i] = std::max(longest[i], r);
+            }
+            if (k % 32 == 31) {
+                while (lo < hi && longest[lo] == limit) ++lo;
+                while (hi > lo && longest[hi - 1] == limit) --hi;
+            }
+        }
+        for (int i = lo; i < hi; ++i) {
+            if (longest[i] < limit) clear_lanes.push_back(i);
+        }
+    }
+
+    // Clear lines from lane i to lane i + d over all d with |d| <= max_offset
+    // (every d when negative), in (i, i + d) order. scan(d, lane_begin,
+    // lane_end, clear_lanes) appends the clear lanes of one offset.
+    template<typename SlopeScan>
+    endpoints_t find_clear_endpoints_batched(int n, int max_offset, SlopeScan&& scan) {
+        int max_d = n - 3;
+        if (max_offset >= 0) max_d = std::min(max_d, max_offset);
+        if (max_d < 0) return {};
+
+        std::vector<std::vector<int>> clear_per_slope(2 * max_d + 1);
+        parallel_for(execution::par, -max_d, max_d + 1, 1, [&](int begin, int end) {
+            for (int d = begin; d < end; ++d) {
+                // Both ends inside [1, n - 2].
+                int lane_begin = std::max(1, 1 - d), lane_end = std::min(n - 1, n - 1 - d);
+                scan(d, lane_begin, lane_end, clear_per_slope[d + max_d]);
+            }
+        });
+
+        std::vector<endpoints_t> per_start(std::max(n, 0));
+        for (int d = -max_d; d <= max_d; ++d) {
+            for (int i : clear_per_slope[d + max_d]) per_start[i].emplace_back(i, i + d);
+        }
+        endpoints_t endpoints;
+        for (auto& start : per_start) endpoints.insert(endpoints.end(), start.begin(), start.end());
+        return endpoints;
+    }
+}
+
+// Same result as find_x_endpoints(binary_image, max_overlaps, max_offset).
+endpoints_t find_x_endpoints_batched(const BinaryImage& binary_image, int max_overlaps, int max_offset = -1) {
+    int height = binary_image.height();
+    detail::PaddedBitRows rows(binary_image);
+    return detail::find_clear_endpoints_batched(binary_image.width(), max_offset, [&](int d, int begin, int end, auto& clear) {
+        detail::scan_slope(rows, LinePattern(d, height - 1), begin, end, max_overlaps, clear);
+    });
+}
+
+// Run-length map version of the above; same result. Overlap limits of 255
+// and more fall back to the bitwise engine.
+endpoints_t find_x_endpoints_runs(const BinaryImage& binary_image, int max_overlaps, int max_offset = -1) {
+    if (max_overlaps >= 255) return find_x_endpoints_batched(binary_image, max_overlaps, max_offset);
+    int height = binary_image.height();
+    Image8 foreground = binary_image.to_image();
+    return detail::find_clear_endpoints_batched(binary_image.width(), max_offset, [&](int d, int begin, int end, auto& clear) {
+        detail::scan_slope_runs(foreground, LinePattern(d, height - 1), begin, end, max_overlaps, clear);
+    });
+}
+
+// Per-line walks like find_x_endpoints, but slope by slope: each offset's
+// LinePattern is built once and every start point walks it with a plain
+// indexed loop, stopping at the first run that is too long.
+template<typename Binary>
+endpoints_t find_x_endpoints_tabled(const Binary& binary_image, int max_overlaps, int max_offset = -1) {
+    int height = binary_image.height();
+    return detail::find_clear_endpoints_batched(binary_image.width(), max_offset, [&](int d, int begin, int end, auto& clear) {
+        LinePattern pattern(d, height - 1);
+        for (int i = begin; i < end; ++i) {
+            if (is_clear_line(binary_image, i, 0, pattern, max_overlaps)) clear.push_back(i);
+        }
+    });
+}
+
+#endif
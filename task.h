@@ -0,0 +1,264 @@
+#ifndef TASK_H_INCLUDED
+#define TASK_H_INCLUDED
+
+#include <mutex>
+#include <deque>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <condition_variable>
+#include "thread_pool.h"
+
+// Lazily started coroutine returning T. Awaiting it starts it and resumes
+// the awaiting coroutine, on whatever thread the task finishes on, once it
+// has produced its value. Exceptions are not supported, as elsewhere in
+// this code base.
+template<typename T = void>
+class Task;
+
+namespace detail {
+    template<typename T>
+    struct TaskPromiseBase {
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+                return h.promise().continuation;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    template<typename T>
+    struct TaskPromise : TaskPromiseBase<T> {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+
+        void return_value(T __value) {
+            value = std::move(__value);
+        }
+
+        T result() {
+            return std::move(*value);
+        }
+    };
+
+    template<>
+    struct TaskPromise<void> : TaskPromiseBase<void> {
+        Task<void> get_return_object();
+
+        void return_void() {}
+
+        void result() {}
+    };
+}
+
+template<typename T>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+    using handle_t = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+
+    explicit Task(handle_t __handle) : _handle(__handle) {}
+
+    Task(Task&& other) noexcept : _handle(std::exchange(other._handle, {})) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (_handle) _handle.destroy();
+            _handle = std::exchange(other._handle, {});
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (_handle) _handle.destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        _handle.promise().continuation = awaiting;
+        return _handle;
+    }
+
+    T await_resume() {
+        return _handle.promise().result();
+    }
+
+private:
+    handle_t _handle;
+};
+
+template<typename T>
+Task<T> detail::TaskPromise<T>::get_return_object() {
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+
+Task<void> detail::TaskPromise<void>::get_return_object() {
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+// Fire-and-forget coroutine: starts immediately and frees itself when done.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+// Awaiting schedule_on(pool) moves the rest of the coroutine onto a worker
+// of pool. This is how a task hops between the I/O and compute executors.
+struct ScheduleAwaiter {
+    ThreadPool& pool;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        pool.submit([h] { h.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+};
+
+ScheduleAwaiter schedule_on(ThreadPool& pool) {
+    return {pool};
+}
+
+// Counting semaphore whose acquire() suspends the awaiting coroutine instead
+// of blocking its thread. release() resumes one waiter inline.
+class AsyncSemaphore {
+public:
+    explicit AsyncSemaphore(int __count) : _count(__count) {}
+
+    struct Awaiter {
+        AsyncSemaphore& semaphore;
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(semaphore._mutex);
+            if (semaphore._count > 0) {
+                --semaphore._count;
+                return true;
+            }
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            std::lock_guard<std::mutex> lock(semaphore._mutex);
+            if (semaphore._count > 0) {
+                --semaphore._count;
+                return false;
+            }
+            semaphore._waiters.push_back(h);
+            return true;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    Awaiter acquire() {
+        return {*this};
+    }
+
+    void release() {
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_waiters.empty()) {
+                ++_count;
+                return;
+            }
+            waiter = _waiters.front();
+            _waiters.pop_front();
+        }
+        waiter.resume();
+    }
+
+private:
+    std::mutex _mutex;
+    int _count;
+    std::deque<std::coroutine_handle<>> _waiters;
+};
+
+// Counts outstanding detached tasks; wait() blocks the calling (non-pool)
+// thread until all of them called done().
+class WaitGroup {
+public:
+    void add(int n = 1) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _count += n;
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_count == 0) _zero.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _zero.wait(lock, [&] { return _count == 0; });
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _zero;
+    int _count = 0;
+};
+
+namespace detail {
+    template<typename T>
+    DetachedTask run_detached(Task<T> task, WaitGroup& group) {
+        co_await task;
+        group.done();
+    }
+}
+
+// Starts task without waiting for it; group.wait() returns once it is done.
+template<typename T>
+void spawn(Task<T> task, WaitGroup& group) {
+    group.add();
+    detail::run_detached(std::move(task), group);
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include "topology.h"
+
+// Fixed set of workers, each with its own task deque. A worker pops from
+// the back of its own deque and, when that is empty, steals from the front
+// of the others, so a worker that finishes its cheap chunks early takes
+// over part of a busy worker's backlog. Threads that wait for their own
+// tasks (parallel_for) run queued tasks while they wait, which makes
+// nested parallel loops safe. Workers can be pinned to CPUs; every task
+// is counted against the NUMA node it ran on.
+class ThreadPool {
+public:
+    using task_t = std::function<void()>;
+
+    explicit ThreadPool(int __nr_threads, PinningPolicy __pinning = PinningPolicy::none) :
+        _tasks_per_node(CpuTopology::get().nr_nodes()) {
+        int nr_threads = std::max(1, __nr_threads);
+        _worker_cpus = CpuTopology::get().worker_cpus(__pinning, nr_threads);
+        for (int i = 0; i < nr_threads; ++i) {
+            _queues.push_back(std::make_unique<Queue>());
+        }
+        for (int i = 0; i < nr_threads; ++i) {
+            _threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_sleep_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto& thread : _threads) thread.join();
+    }
+
+    // Sized from COUNT_DOTS_THREADS if set, otherwise one worker per core,
+    // and pinned according to COUNT_DOTS_PINNING (none, compact, scatter).
+    static ThreadPool& global() {
+        static ThreadPool pool(default_nr_threads(), pinning_policy_from_env());
+        return pool;
+    }
+
+    static int default_nr_threads() {
+        if (const char* env = std::getenv("COUNT_DOTS_THREADS")) {
+            int n = std::atoi(env);
+            if (n > 0) return n;
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    int size() const {
+        return static_cast<int>(_queues.size());
+    }
+
+    // CPU each worker is pinned to, -1 where unpinned.
+    const std::vector<int>& worker_cpus() const {
+        return _worker_cpus;
+    }
+
+    // Tasks run so far on each NUMA node, by whichever thread ran them.
+    std::vector<long> tasks_per_node() const {
+        std::vector<long> counts;
+        for (auto& count : _tasks_per_node) counts.push_back(count.load(std::memory_order_relaxed));
+        return counts;
+    }
+
+    // Index of the calling worker in this pool, or -1 for other threads.
+    int worker_index() const {
+        return _current_pool == this ? _current_index : -1;
+    }
+
+    void submit(task_t task) {
+        int index = worker_index();
+        if (index < 0) index = _next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+        {
+            std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+            _queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_sleep_mutex);
+            ++_pending;
+        }
+        _wake.notify_one();
+    }
+
+    // Runs queued tasks on the calling thread until done() holds.
+    template<typename Predicate>
+    void help_until(Predicate&& done) {
+        int index = worker_index();
+        task_t task;
+        while (!done()) {
+            if (try_get(index, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_done_mutex);
+            _done.wait(lock, [&] { return done() || _pending.load() > 0; });
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<task_t> tasks;
+    };
+
+    bool try_get(int index, task_t& task) {
+        int n = size();
+        if (index >= 0) {
+            std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+            auto& tasks = _queues[index]->tasks;
+            if (!tasks.empty()) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+                --_pending;
+                return true;
+            }
+        }
+        int start = index < 0 ? 0 : index + 1;
+        for (int k = 0; k < n; ++k) {
+            int victim = (start + k) % n;
+            if (victim == index) continue;
+            std::lock_guard<std::mutex> lock(_queues[victim]->mutex);
+            auto& tasks = _queues[victim]->tasks;
+            if (!tasks.empty()) {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                --_pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(task_t& task) {
+        _tasks_per_node[CpuTopology::get().current_node()].fetch_add(1, std::memory_order_relaxed);
+        task();
+        task = nullptr;
+        { std::lock_guard<std::mutex> lock(_done_mutex); }
+        _done.notify_all();
+    }
+
+    void worker_loop(int index) {
+        _current_pool = this;
+        _current_index = index;
+        if (_worker_cpus[index] >= 0) pin_current_thread(_worker_cpus[index]);
+        task_t task;
+        while (true) {
+            if (try_get(index, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_sleep_mutex);
+            _wake.wait(lock, [&] { return _stop || _pending.load() > 0; });
+            if (_stop && _pending.load() == 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::vector<int> _worker_cpus;
+    std::vector<std::atomic<long>> _tasks_per_node;
+    std::atomic<int> _next_queue{0};
+    std::atomic<int> _pending{0};
+
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    bool _stop = false;
+
+    std::mutex _done_mutex;
+    std::condition_variable _done;
+
+    static thread_local const ThreadPool* _current_pool;
+    static thread_local int _current_index;
+};
+
+thread_local const ThreadPool* ThreadPool::_current_pool = nullptr;
+thread_local int ThreadPool::_current_index = -1;
+
+// Execution-policy tags for the parallel loop overloads.
+struct SequencedPolicy {};
+struct ParallelPolicy {};
+
+namespace execution {
+    inline constexpr SequencedPolicy seq{};
+    inline constexpr ParallelPolicy par{};
+}
+
+// Calls body(chunk_begin, chunk_end) over [begin, end) in chunks of `grain`
+// elements (0 picks about four chunks per worker) and returns once every
+// chunk is done. Chunks are scheduled dynamically on the pool.
+template<typename Functor>
+void parallel_for(int begin, int end, int grain, Functor&& body, ThreadPool& pool = ThreadPool::global()) {
+    int n = end - begin;
+    if (n <= 0) return;
+    if (grain <= 0) grain = std::max(1, n / (4 * pool.size()));
+    if (n <= grain || pool.size() == 1) {
+        body(begin, end);
+        return;
+    }
+
+    int nr_chunks = (n + grain - 1) / grain;
+    std::atomic<int> remaining{nr_chunks};
+    for (int c = 0; c < nr_chunks; ++c) {
+        int chunk_begin = begin + c * grain;
+        int chunk_end = std::min(end, chunk_begin + grain);
+        pool.submit([&, chunk_begin, chunk_end] {
+            body(chunk_begin, chunk_end);
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    pool.help_until([&] { return remaining.load(std::memory_order_acquire) == 0; });
+}
+
+template<typename Functor>
+void parallel_for(const SequencedPolicy&, int begin, int end, int, Functor&& body) {
+    if (begin < end) body(begin, end);
+}
+
+template<typename Functor>
+void parallel_for(const ParallelPolicy&, int begin, int end, int grain, Functor&& body) {
+    parallel_for(begin, end, grain, std::forward<Functor>(body));
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef TOPOLOGY_H_INCLUDED
+#define TOPOLOGY_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+// Where worker threads are pinned. compact fills one NUMA node's CPUs
+// before moving to the next; scatter deals workers round-robin across nodes.
+enum class PinningPolicy {
+    none,
+    compact,
+    scatter
+};
+
+// How large pixel buffers are spread over NUMA nodes. first_touch leaves
+// placement to the kernel, which puts each page on the node of whichever
+// thread writes it first. Row bands are stolen by any worker and the
+// BufferPool hands out pages that were touched by an earlier image, so
+// this promises no locality at all. interleave binds buffers round-robin
+// across all nodes with mbind, which evens out memory bandwidth between
+// nodes and is the option to pick on multi-node hosts.
+enum class NumaPlacement {
+    first_touch,
+    interleave
+};
+
+// CPU and NUMA node layout read from /sys. Anything that cannot be read
+// (non-Linux hosts, containers without /sys) collapses to a single node
+// holding every CPU, which turns all NUMA handling into a no-op.
+class CpuTopology {
+public:
+    static const CpuTopology& get() {
+        static CpuTopology topology = detect();
+        return topology;
+    }
+
+    int nr_nodes() const {
+        return static_cast<int>(_node_cpus.size());
+    }
+
+    const std::vector<int>& cpus(int node) const {
+        return _node_cpus[node];
+    }
+
+    int node_of_cpu(int cpu) const {
+        for (int node = 0; node < nr_nodes(); ++node) {
+            auto& cpus = _node_cpus[node];
+            if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) return node;
+        }
+        return 0;
+    }
+
+    // Node of the CPU the calling thread is running on right now.
+    int current_node() const {
+#ifdef __linux__
+        if (nr_nodes() > 1) {
+            int cpu = sched_getcpu();
+            if (cpu >= 0) return node_of_cpu(cpu);
+        }
+#endif
+        return 0;
+    }
+
+    // CPU for each of nr_workers workers under policy, or -1 for unpinned.
+    std::vector<int> worker_cpus(PinningPolicy policy, int nr_workers) const {
+        std::vector<int> result(nr_workers, -1);
+        if (policy == PinningPolicy::none) return result;
+
+        std::vector<int> order;
+        if (policy == PinningPolicy::compact) {
+            for (auto& cpus : _node_cpus) order.insert(order.end(), cpus.begin(), cpus.end());
+        } else {
+            for (std::size_t k = 0; order.size() < nr_cpus(); ++k) {
+                for (auto& cpus : _node_cpus) {
+                    if (k < cpus.size()) order.push_back(cpus[k]);
+                }
+            }
+        }
+        if (order.empty()) return result;
+        for (int w = 0; w < nr_workers; ++w) result[w] = order[w % order.size()];
+        return result;
+    }
+
+private:
+    std::size_t nr_cpus() const {
+        std::size_t n = 0;
+        for (auto& cpus : _node_cpus) n += cpus.size();
+        return n;
+    }
+
+    // Parses a /sys cpulist such as "0-3,8-11".
+    static std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::size_t pos = 0;
+        while (pos < list.size()) {
+            std::size_t comma = list.find(',', pos);
+            if (comma == std::string::npos) comma = list.size();
+            std::string range = list.substr(pos, comma - pos);
+            std::size_t dash = range.find('-');
+            if (!range.empty() && range.find_first_not_of("0123456789-\n") == std::string::npos) {
+                int first = std::atoi(range.c_str());
+                int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+                for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+            }
+            pos = comma + 1;
+        }
+        return cpus;
+    }
+
+    static CpuTopology detect() {
+        CpuTopology topology;
+        for (int node = 0;; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!file) break;
+            std::string list;
+            std::getline(file, list);
+            auto cpus = parse_cpu_list(list);
+            if (!cpus.empty()) topology._node_cpus.push_back(cpus);
+        }
+        if (topology._node_cpus.empty()) {
+            std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+            for (std::size_t cpu = 0; cpu < cpus.size(); ++cpu) cpus[cpu] = static_cast<int>(cpu);
+            topology._node_cpus.push_back(cpus);
+        }
+        return topology;
+    }
+
+    std::vector<std::vector<int>> _node_cpus;
+};
+
+bool pin_current_thread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Spreads the whole pages of [p, p + bytes) round-robin over all nodes.
+// Returns false (leaving placement alone) on single-node hosts or if the
+// kernel refuses.
+bool interleave_memory(void* p, std::size_t bytes) {
+#if defined(__linux__) && defined(SYS_mbind)
+    const auto& topology = CpuTopology::get();
+    if (topology.nr_nodes() <= 1) return false;
+
+    constexpr int mpol_interleave = 3;
+    std::uintptr_t page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+    std::uintptr_t begin = (reinterpret_cast<std::uintptr_t>(p) + page - 1) / page * page;
+    std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(p) + bytes) / page * page;
+    if (end <= begin) return false;
+
+    unsigned long nodemask = 0;
+    for (int node = 0; node < topology.nr_nodes() && node < 64; ++node) nodemask |= 1ul << node;
+    return syscall(SYS_mbind, begin, end - begin, mpol_interleave, &nodemask, 64, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+PinningPolicy pinning_policy_from_env() {
+    const char* env = std::getenv("COUNT_DOTS_PINNING");
+    std::string value = env ? env : "";
+    if (value == "compact") return PinningPolicy::compact;
+    if (value == "scatter") return PinningPolicy::scatter;
+    return PinningPolicy::none;
+}
+
+// Read once from COUNT_DOTS_NUMA (first_touch or interleave).
+NumaPlacement numa_placement() {
+    static NumaPlacement placement = [] {
+        const char* env = std::getenv("COUNT_DOTS_NUMA");
+        return env && std::string(env) == "interleave" ? NumaPlacement::interleave : NumaPlacement::first_touch;
+    }();
+    return placement;
+}
+
+#endif
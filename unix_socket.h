@@ -0,0 +1,132 @@
+#ifndef UNIX_SOCKET_H_INCLUDED
+#define UNIX_SOCKET_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+#include <sys/un.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Line-oriented protocol between `main --serve` and `client`. A request is
+//     path <path>\n                    process an image file on the server
+//     image <nr_bytes>\n<bytes>        process an encoded image sent inline
+//     shutdown\n                       stop the server
+// and every request except shutdown is answered with
+//     ok <nr_bytes>\n<report>          or    error <message>\n
+// where the report is plain text (see format_grid_report in main.cc).
+
+int listen_unix(const std::string& path, int backlog = 16) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << '\n';
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Failed to create socket: " << std::strerror(errno) << '\n';
+        return -1;
+    }
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, backlog) < 0) {
+        std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << '\n';
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connect_unix(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << '\n';
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        std::cerr << "Failed to connect to " << path << ": " << std::strerror(errno) << '\n';
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Writes all of [data, data + size), retrying short writes. MSG_NOSIGNAL
+// turns a vanished peer into an error instead of SIGPIPE.
+bool write_all(int fd, const void* data, std::size_t size) {
+    auto p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool write_all(int fd, const std::string& data) {
+    return write_all(fd, data.data(), data.size());
+}
+
+// Buffered reads of header lines and the payloads that follow them.
+class SocketReader {
+public:
+    explicit SocketReader(int __fd) : _fd(__fd) {}
+
+    // Reads up to and excluding the next '\n'. False on EOF or error.
+    bool read_line(std::string& line) {
+        line.clear();
+        while (true) {
+            for (; _pos < _end; ++_pos) {
+                if (_buffer[_pos] == '\n') {
+                    ++_pos;
+                    return true;
+                }
+                line += _buffer[_pos];
+            }
+            if (!fill()) return false;
+        }
+    }
+
+    bool read_bytes(std::vector<unsigned char>& bytes, std::size_t size) {
+        bytes.resize(size);
+        std::size_t done = 0;
+        while (done < size) {
+            if (_pos == _end && !fill()) return false;
+            std::size_t n = std::min(size - done, _end - _pos);
+            std::memcpy(bytes.data() + done, _buffer + _pos, n);
+            _pos += n;
+            done += n;
+        }
+        return true;
+    }
+
+private:
+    bool fill() {
+        while (true) {
+            ssize_t n = recv(_fd, _buffer, sizeof(_buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            _pos = 0;
+            _end = n;
+            return true;
+        }
+    }
+
+    int _fd;
+    char _buffer[1 << 16];
+    std::size_t _pos = 0, _end = 0;
+};
+
+#endif
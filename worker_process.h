@@ -0,0 +1,72 @@
+#ifndef WORKER_PROCESS_H_INCLUDED
+#define WORKER_PROCESS_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+// Child process running a fresh copy of this binary, connected to the parent
+// through a socket pair. The parent talks over fd, the child over the
+// descriptor number appended to its arguments.
+struct WorkerProcess {
+    pid_t pid = -1;
+    int fd = -1;
+};
+
+// fork + exec of /proc/self/exe with args. Everything the child needs is
+// prepared before fork, so the child only clears a flag, closes and execs.
+// Both ends are close-on-exec, so later workers do not inherit this
+// worker's coordinator end and closing it reaches the worker as EOF; the
+// child only keeps its own end across exec.
+WorkerProcess start_worker_process(const std::vector<std::string>& args) {
+    WorkerProcess worker;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        std::cerr << "Failed to create socket pair: " << std::strerror(errno) << '\n';
+        return worker;
+    }
+
+    std::vector<std::string> argument_strings{"/proc/self/exe"};
+    argument_strings.insert(argument_strings.end(), args.begin(), args.end());
+    argument_strings.push_back(std::to_string(fds[1]));
+    std::vector<char*> argv;
+    for (auto& argument : argument_strings) argv.push_back(argument.data());
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Failed to fork worker: " << std::strerror(errno) << '\n';
+        close(fds[0]);
+        close(fds[1]);
+        return worker;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        if (fcntl(fds[1], F_SETFD, 0) < 0) _exit(127);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    worker.pid = pid;
+    worker.fd = fds[0];
+    return worker;
+}
+
+// Human-readable waitpid status, e.g. "killed by signal 11 (Segmentation fault)".
+std::string describe_exit_status(int status) {
+    if (WIFSIGNALED(status)) {
+        int signal = WTERMSIG(status);
+        return "killed by signal " + std::to_string(signal) + " (" + strsignal(signal) + ")";
+    }
+    if (WIFEXITED(status)) return "exited with status " + std::to_string(WEXITSTATUS(status));
+    return "stopped";
+}
+
+#endif